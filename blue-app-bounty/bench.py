@@ -0,0 +1,238 @@
+#!/usr/bin/env python
+"""
+*******************************************************************************
+*   Simple bountry
+*   (c) 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************
+"""
+
+# Host side benchmarks of the bounty application.
+# try: exception frames cost, requires an application built with
+#      HAVE_TRY_STATS
+# stack: stack high water mark, requires an application built with
+#        HAVE_STACK_PAINT
+# hot:   HOT_SOURCES functions timings, requires an application built with
+#        HAVE_HOT_BENCH, --json writes them for make profile-report
+# pic:   PIC() accounting of an exchange, requires an application built with
+#        HAVE_PIC_STATS (build with and without HAVE_PIC_CACHE to compare)
+# trace: I/O trace ring dump, requires an application built with
+#        HAVE_IO_TRACE, rendered by io_trace.py of the SDK
+# reset: EXCEPTION_IO_RESET recoveries, requires an application built with
+#        HAVE_IO_WARM_RESET. Resets are provoked by interrupting a client
+#        during an exchange (warm) or by a bus reset (cold)
+# u2f:   U2F registration and authentication latency without the transport,
+#        requires an application built with HAVE_U2F_AUTHENTICATOR,
+#        HAVE_U2F_DEV_ATTESTATION and HAVE_U2F_BENCH. Operations take tens of
+#        ms, run it with a few iterations (--iterations 10). Authentications
+#        advance the signature counter, persisted at each iteration
+
+from __future__ import print_function
+
+import argparse
+import json
+import struct
+import time
+
+from ledgerblue.comm import getDongle
+
+CLA = 0xE0
+INS_GET_PUBLIC_KEY = 0x02
+INS_BENCH_TRY = 0x09
+INS_TRY_STATS = 0x0A
+INS_STACK_INFO = 0x0B
+INS_BENCH_HOT = 0x0C
+INS_PIC_STATS = 0x0D
+INS_IO_TRACE = 0x0F
+INS_IO_RESET_STATS = 0x10
+INS_BENCH_U2F = 0x11
+
+BENCH_TRY_MODES = [
+    (0x00, "empty loop"),
+    (0x01, "TRY/FINALLY frame"),
+    (0x02, "TRY/THROW/CATCH"),
+    (0x03, "status return"),
+]
+
+BENCH_HOT_MODES = [
+    (0x00, "empty loop"),
+    (0x01, "encode_base58"),
+    (0x02, "os_memmove"),
+]
+
+BENCH_U2F_MODES = [
+    (0x00, "empty loop"),
+    (0x01, "unwrap, derivation"),
+    (0x02, "unwrap"),
+    (0x03, "register"),
+    (0x04, "authenticate"),
+]
+
+
+def apdu(ins, p1=0, p2=0, data=b""):
+    return bytearray([CLA, ins, p1, p2, len(data)]) + bytearray(data)
+
+
+def parse_try_stats(response):
+    frames, throws, depth, stack = struct.unpack(">IIII", bytes(response[:16]))
+    return {"frames": frames, "throws": throws, "depth": depth,
+            "stack": stack}
+
+
+def timed_exchange(dongle, command, repeat):
+    best = None
+    for _ in range(repeat):
+        start = time.time()
+        response = dongle.exchange(command)
+        elapsed = time.time() - start
+        if best is None or elapsed < best:
+            best = elapsed
+    return best, response
+
+
+def bench_try(dongle, iterations, repeat):
+    print("exception frames, %d iterations, best of %d" % (iterations, repeat))
+    baseline = None
+    for mode, name in BENCH_TRY_MODES:
+        data = struct.pack(">BH", mode, iterations)
+        elapsed, response = timed_exchange(dongle, apdu(INS_BENCH_TRY,
+                                                        data=data), repeat)
+        stats = parse_try_stats(response)
+        if baseline is None:
+            baseline = elapsed
+        cost = (elapsed - baseline) * 1e6 / iterations
+        print("  %-20s %8.2f us/iteration  frames=%d throws=%d" %
+              (name, cost, stats["frames"], stats["throws"]))
+
+    # accounting of a regular command, as seen by the main loop
+    dongle.exchange(apdu(INS_GET_PUBLIC_KEY))
+    stats = parse_try_stats(dongle.exchange(apdu(INS_TRY_STATS)))
+    print("per APDU (INS_GET_PUBLIC_KEY): frames=%d throws=%d depth=%d "
+          "frames stack=%d bytes" % (stats["frames"], stats["throws"],
+                                     stats["depth"], stats["stack"]))
+
+
+def bench_stack(dongle):
+    # exercise the commands first, the worst one is kept by the device
+    dongle.exchange(apdu(INS_GET_PUBLIC_KEY))
+    response = dongle.exchange(apdu(INS_STACK_INFO))
+    size, worst, ins, last = struct.unpack(">HHBH", bytes(response[:7]))
+    print("stack: %d bytes, worst usage %d bytes (INS 0x%02X), "
+          "headroom %d bytes" % (size, worst, ins, size - worst))
+    print("previous exchange usage: %d bytes" % last)
+
+
+def bench_hot(dongle, iterations, repeat, output):
+    print("hot functions, %d iterations, best of %d" % (iterations, repeat))
+    baseline = None
+    timings = {}
+    for mode, name in BENCH_HOT_MODES:
+        data = struct.pack(">BH", mode, iterations)
+        elapsed, _ = timed_exchange(dongle, apdu(INS_BENCH_HOT, data=data),
+                                    repeat)
+        if baseline is None:
+            baseline = elapsed
+            continue
+        timings[name] = (elapsed - baseline) * 1e6 / iterations
+        print("  %-20s %8.2f us/call" % (name, timings[name]))
+    if output:
+        with open(output, "w") as f:
+            json.dump(timings, f, indent=1, sort_keys=True)
+            f.write("\n")
+
+
+def read_pic_stats(dongle, reset):
+    response = dongle.exchange(apdu(INS_PIC_STATS, p1=1 if reset else 0))
+    return struct.unpack(">III", bytes(response[:12]))
+
+
+def bench_pic(dongle):
+    read_pic_stats(dongle, True)
+    dongle.exchange(apdu(INS_GET_PUBLIC_KEY))
+    calls, translations, redraws = read_pic_stats(dongle, True)
+    # the stats exchange itself is accounted too, it is in both runs
+    print("INS_GET_PUBLIC_KEY exchange: pic() calls=%d translations=%d" %
+          (calls, translations))
+    # redraws are driven by the ux, let it run for a while
+    time.sleep(2)
+    calls, translations, redraws = read_pic_stats(dongle, True)
+    print("ux, over 2s: redraws=%d pic() calls=%d translations=%d" %
+          (redraws, calls, translations))
+    if redraws:
+        print("per redraw: pic() calls=%.1f translations=%.1f" %
+              (float(calls) / redraws, float(translations) / redraws))
+
+
+def dump_trace(dongle, output):
+    # a few exchanges first, so that the dump holds complete apdus
+    for i in range(3):
+        dongle.exchange(apdu(INS_GET_PUBLIC_KEY))
+    response = dongle.exchange(apdu(INS_IO_TRACE))
+    with open(output, "wb") as f:
+        f.write(bytes(response))
+    written, = struct.unpack(">I", bytes(response[:4]))
+    print("%d trace records written, dump saved to %s" % (written, output))
+
+
+def bench_reset(dongle, reset):
+    response = dongle.exchange(apdu(INS_IO_RESET_STATS, p1=1 if reset else 0))
+    values = struct.unpack(">HHHHHH", bytes(response[:12]))
+    print("%-6s %6s %8s %8s" % ("reset", "count", "last ms", "max ms"))
+    for name, stats in zip(["cold", "warm"], [values[:3], values[3:]]):
+        print("%-6s %6d %8d %8d" % ((name,) + stats))
+
+
+def bench_u2f(dongle, iterations, repeat):
+    print("u2f operations, %d iterations, best of %d" % (iterations, repeat))
+    baseline = None
+    for mode, name in BENCH_U2F_MODES:
+        data = struct.pack(">BH", mode, iterations)
+        elapsed, _ = timed_exchange(dongle, apdu(INS_BENCH_U2F, data=data),
+                                    repeat)
+        if baseline is None:
+            baseline = elapsed
+            continue
+        print("  %-20s %8.2f ms/call" %
+              (name, (elapsed - baseline) * 1e3 / iterations))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("bench", choices=["try", "stack", "hot", "pic", "trace",
+                                          "reset", "u2f"])
+    parser.add_argument("--iterations", type=int, default=1000)
+    parser.add_argument("--repeat", type=int, default=5)
+    parser.add_argument("--json", help="hot: timings output, "
+                        "debug/profiles/<profile>.bench.json")
+    parser.add_argument("--output", default="trace.bin",
+                        help="trace: binary dump output")
+    parser.add_argument("--clear", action="store_true",
+                        help="reset: clear the statistics once read")
+    args = parser.parse_args()
+
+    dongle = getDongle(False)
+    if args.bench == "try":
+        bench_try(dongle, args.iterations, args.repeat)
+    elif args.bench == "stack":
+        bench_stack(dongle)
+    elif args.bench == "hot":
+        bench_hot(dongle, args.iterations, args.repeat, args.json)
+    elif args.bench == "pic":
+        bench_pic(dongle)
+    elif args.bench == "trace":
+        dump_trace(dongle, args.output)
+    elif args.bench == "reset":
+        bench_reset(dongle, args.clear)
+    elif args.bench == "u2f":
+        bench_u2f(dongle, args.iterations, args.repeat)
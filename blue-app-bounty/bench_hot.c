@@ -0,0 +1,69 @@
+/*******************************************************************************
+*   Simple bountry
+*   (c) 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+// Host build of the HOT_SOURCES functions, timed by profile_report.py for each
+// optimization level (make profile-report HOST_BENCH=bench_hot.c).
+// One line per function: name, ns per call.
+
+#include <stdio.h>
+#include <time.h>
+
+#include "os.h"
+#include "base58.h"
+
+try_context_t *G_try_last_open_context;
+
+#define ITERATIONS 20000
+
+static unsigned char input[260];
+static unsigned char output[260];
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double bench_base58(void) {
+    unsigned int i;
+    double start = now_ns();
+    for (i = 0; i < ITERATIONS; i++) {
+        input[32 + (i & 15)] = i;
+        encode_base58(input + 32, 25, output, 40);
+    }
+    return (now_ns() - start) / ITERATIONS;
+}
+
+static double bench_memmove(void) {
+    unsigned int i;
+    double start = now_ns();
+    for (i = 0; i < ITERATIONS; i++) {
+        input[i & 127] = i;
+        os_memmove(output + 64, input + 128, 128);
+    }
+    return (now_ns() - start) / ITERATIONS;
+}
+
+int main(void) {
+    unsigned int i;
+    for (i = 0; i < sizeof(input); i++) {
+        input[i] = i * 7 + 1;
+    }
+    printf("encode_base58 %.1f\n", bench_base58());
+    printf("os_memmove %.1f\n", bench_memmove());
+    return 0;
+}
@@ -0,0 +1,175 @@
+/*******************************************************************************
+*   Simple bountry
+*   (c) 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#include "aes_stream.h"
+
+#ifdef HAVE_AES_STREAM
+
+aes_stream_stats_t aes_stream_stats[AES_STREAM_MEDIA_COUNT];
+
+static void aes_stream_increment_counter(uint8_t *counter) {
+    uint8_t i = CX_AES_BLOCK_SIZE;
+    while (i--) {
+        if (++counter[i]) {
+            break;
+        }
+    }
+}
+
+void aes_stream_reset(aes_stream_t *stream) {
+    // key schedule and chaining state wiped, the stream is not initialized
+    os_memset(stream, 0, sizeof(aes_stream_t));
+}
+
+void aes_stream_init(aes_stream_t *stream, uint8_t mode, uint8_t encrypt,
+                     const uint8_t *key, uint8_t keyLength, const uint8_t *iv) {
+    // a rejected init does not leave the previous stream usable
+    aes_stream_reset(stream);
+    if (((mode != AES_STREAM_CBC) && (mode != AES_STREAM_CTR)) ||
+        ((keyLength != 16) && (keyLength != 24) && (keyLength != 32))) {
+        THROW(INVALID_PARAMETER);
+    }
+    cx_aes_init_key((unsigned char *)key, keyLength, &stream->key);
+    os_memmove(stream->iv, iv, CX_AES_BLOCK_SIZE);
+    stream->keystreamOffset = CX_AES_BLOCK_SIZE;
+    stream->mode = mode;
+    stream->encrypt = encrypt;
+}
+
+static void aes_stream_process_cbc(aes_stream_t *stream, uint8_t *buffer,
+                                   uint16_t length) {
+    uint8_t nextIv[CX_AES_BLOCK_SIZE];
+
+    if (length % CX_AES_BLOCK_SIZE) {
+        THROW(INVALID_PARAMETER);
+    }
+    // the chaining block is read from the end of the data
+    if (length == 0) {
+        return;
+    }
+    if (stream->encrypt) {
+        cx_aes_iv(&stream->key,
+                  CX_LAST | CX_ENCRYPT | CX_CHAIN_CBC | CX_PAD_NONE,
+                  stream->iv, buffer, length, buffer);
+        os_memmove(stream->iv, buffer + length - CX_AES_BLOCK_SIZE,
+                   CX_AES_BLOCK_SIZE);
+    } else {
+        // the last ciphertext block is overwritten by the in place decryption
+        os_memmove(nextIv, buffer + length - CX_AES_BLOCK_SIZE,
+                   CX_AES_BLOCK_SIZE);
+        cx_aes_iv(&stream->key,
+                  CX_LAST | CX_DECRYPT | CX_CHAIN_CBC | CX_PAD_NONE,
+                  stream->iv, buffer, length, buffer);
+        os_memmove(stream->iv, nextIv, CX_AES_BLOCK_SIZE);
+    }
+}
+
+static void aes_stream_process_ctr(aes_stream_t *stream, uint8_t *buffer,
+                                   uint16_t length) {
+    uint8_t keystream[AES_STREAM_CTR_BLOCKS * CX_AES_BLOCK_SIZE];
+    uint16_t chunk;
+    uint8_t i;
+
+    // consume what is left of the previous chunk keystream
+    chunk = CX_AES_BLOCK_SIZE - stream->keystreamOffset;
+    if (chunk > length) {
+        chunk = length;
+    }
+    os_xor(buffer, buffer, stream->keystream + stream->keystreamOffset, chunk);
+    stream->keystreamOffset += chunk;
+    buffer += chunk;
+    length -= chunk;
+
+    // full blocks, batched to amortize the syscall cost
+    while (length >= CX_AES_BLOCK_SIZE) {
+        chunk = length / CX_AES_BLOCK_SIZE;
+        if (chunk > AES_STREAM_CTR_BLOCKS) {
+            chunk = AES_STREAM_CTR_BLOCKS;
+        }
+        for (i = 0; i < chunk; i++) {
+            os_memmove(keystream + i * CX_AES_BLOCK_SIZE, stream->iv,
+                       CX_AES_BLOCK_SIZE);
+            aes_stream_increment_counter(stream->iv);
+        }
+        chunk *= CX_AES_BLOCK_SIZE;
+        cx_aes(&stream->key, CX_LAST | CX_ENCRYPT | CX_CHAIN_ECB | CX_PAD_NONE,
+               keystream, chunk, keystream);
+        os_xor(buffer, buffer, keystream, chunk);
+        buffer += chunk;
+        length -= chunk;
+    }
+
+    // trailing partial block, keep its keystream for the next chunk
+    if (length) {
+        cx_aes(&stream->key, CX_LAST | CX_ENCRYPT | CX_CHAIN_ECB | CX_PAD_NONE,
+               stream->iv, CX_AES_BLOCK_SIZE, stream->keystream);
+        aes_stream_increment_counter(stream->iv);
+        os_xor(buffer, buffer, stream->keystream, length);
+        stream->keystreamOffset = length;
+    }
+}
+
+void aes_stream_process(aes_stream_t *stream, uint8_t *buffer,
+                        uint16_t length) {
+    switch (stream->mode) {
+    case AES_STREAM_CBC:
+        aes_stream_process_cbc(stream, buffer, length);
+        break;
+    case AES_STREAM_CTR:
+        aes_stream_process_ctr(stream, buffer, length);
+        break;
+    default:
+        // not initialized
+        THROW(INVALID_PARAMETER);
+    }
+}
+
+void aes_stream_stats_reset(void) {
+    os_memset(aes_stream_stats, 0, sizeof(aes_stream_stats));
+}
+
+void aes_stream_stats_add(unsigned int media, unsigned int length,
+                          uint32_t nowMs) {
+    aes_stream_stats_t *stats;
+    if (media >= AES_STREAM_MEDIA_COUNT) {
+        return;
+    }
+    stats = &aes_stream_stats[media];
+    if (stats->bytes == 0) {
+        stats->firstMs = nowMs;
+    }
+    stats->bytes += length;
+    stats->lastMs = nowMs;
+}
+
+uint32_t aes_stream_stats_throughput(unsigned int media) {
+    uint32_t elapsed;
+    aes_stream_stats_t *stats;
+    if (media >= AES_STREAM_MEDIA_COUNT) {
+        return 0;
+    }
+    stats = &aes_stream_stats[media];
+    elapsed = stats->lastMs - stats->firstMs;
+    // the ticker resolution does not allow measuring a single chunk
+    if (elapsed == 0) {
+        return 0;
+    }
+    return (stats->bytes / elapsed) * 1000 +
+           ((stats->bytes % elapsed) * 1000) / elapsed;
+}
+
+#endif
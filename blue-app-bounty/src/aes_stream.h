@@ -0,0 +1,95 @@
+/*******************************************************************************
+*   Simple bountry
+*   (c) 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#include <stdint.h>
+
+#include "os.h"
+#include "cx.h"
+
+#ifndef __AES_STREAM_H__
+
+#define __AES_STREAM_H__
+
+/**
+ * AES CBC/CTR stream whose chaining state survives across APDUs.
+ * Data is processed in place, chunk by chunk.
+ */
+
+#define AES_STREAM_CBC 0x01
+#define AES_STREAM_CTR 0x02
+
+// counter blocks ciphered per cx_aes call in CTR mode
+#ifndef AES_STREAM_CTR_BLOCKS
+#define AES_STREAM_CTR_BLOCKS 4
+#endif
+
+// one entry per io_apdu_media_t value, NONE being the U2F proxy path
+#define AES_STREAM_MEDIA_COUNT (IO_APDU_MEDIA_USB_CCID + 1)
+
+typedef struct aes_stream_s {
+    cx_aes_key_t key;
+    // CBC: last ciphertext block, CTR: next counter block
+    uint8_t iv[CX_AES_BLOCK_SIZE];
+    // CTR: keystream of the last partially consumed block
+    uint8_t keystream[CX_AES_BLOCK_SIZE];
+    uint8_t keystreamOffset;
+    uint8_t mode;
+    uint8_t encrypt;
+} aes_stream_t;
+
+typedef struct aes_stream_stats_s {
+    uint32_t bytes;
+    uint32_t firstMs;
+    uint32_t lastMs;
+} aes_stream_stats_t;
+
+/**
+ * @throws INVALID_PARAMETER
+ */
+void aes_stream_init(aes_stream_t *stream, uint8_t mode, uint8_t encrypt,
+                     const uint8_t *key, uint8_t keyLength, const uint8_t *iv);
+
+/**
+ * Wipe the key and the chaining state, the stream has to be initialized
+ * again.
+ */
+void aes_stream_reset(aes_stream_t *stream);
+
+/**
+ * Process length bytes in place. In CBC mode length shall be a multiple of
+ * CX_AES_BLOCK_SIZE, the host is in charge of the padding.
+ * @throws INVALID_PARAMETER
+ */
+void aes_stream_process(aes_stream_t *stream, uint8_t *buffer,
+                        uint16_t length);
+
+void aes_stream_stats_reset(void);
+
+/**
+ * Account length processed bytes on the given media at the given ticker time.
+ */
+void aes_stream_stats_add(unsigned int media, unsigned int length,
+                          uint32_t nowMs);
+
+/**
+ * @return the measured throughput in bytes per second for the given media
+ */
+uint32_t aes_stream_stats_throughput(unsigned int media);
+
+extern aes_stream_stats_t aes_stream_stats[AES_STREAM_MEDIA_COUNT];
+
+#endif
@@ -0,0 +1,68 @@
+/*******************************************************************************
+*   Simple bountry
+*   (c) 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#include "base58.h"
+
+static const unsigned char const BASE58ALPHABET[] = {
+    '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F',
+    'G', 'H', 'J', 'K', 'L', 'M', 'N', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W',
+    'X', 'Y', 'Z', 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'm',
+    'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z'};
+
+unsigned char encode_base58(unsigned char WIDE *in, unsigned char length,
+                            unsigned char *out, unsigned char maxoutlen) {
+    unsigned char tmp[164];
+    unsigned char buffer[164];
+    unsigned char j;
+    unsigned char startAt;
+    unsigned char zeroCount = 0;
+    if (length > sizeof(tmp)) {
+        THROW(INVALID_PARAMETER);
+    }
+    os_memmove(tmp, in, length);
+    while ((zeroCount < length) && (tmp[zeroCount] == 0)) {
+        ++zeroCount;
+    }
+    j = 2 * length;
+    startAt = zeroCount;
+    while (startAt < length) {
+        unsigned short remainder = 0;
+        unsigned char divLoop;
+        for (divLoop = startAt; divLoop < length; divLoop++) {
+            unsigned short digit256 = (unsigned short)(tmp[divLoop] & 0xff);
+            unsigned short tmpDiv = remainder * 256 + digit256;
+            tmp[divLoop] = (unsigned char)(tmpDiv / 58);
+            remainder = (tmpDiv % 58);
+        }
+        if (tmp[startAt] == 0) {
+            ++startAt;
+        }
+        buffer[--j] = (unsigned char)BASE58ALPHABET[remainder];
+    }
+    while ((j < (2 * length)) && (buffer[j] == BASE58ALPHABET[0])) {
+        ++j;
+    }
+    while (zeroCount-- > 0) {
+        buffer[--j] = BASE58ALPHABET[0];
+    }
+    length = 2 * length - j;
+    if (maxoutlen < length) {
+        THROW(EXCEPTION_OVERFLOW);
+    }
+    os_memmove(out, (buffer + j), length);
+    return length;
+}
@@ -0,0 +1,54 @@
+/*******************************************************************************
+*   Simple bountry
+*   (c) 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#ifndef __IO_OVERLAY_APP_H__
+
+#define __IO_OVERLAY_APP_H__
+
+/**
+ * Application members of the I/O overlay, see os_io_overlay.h.
+ * The HID report usage page is chosen once by USB_power_U2F: reports either
+ * go to the Ledger HID framing (G_io_hid_chunk) or to the U2F transport,
+ * never both, so the U2F buffers can share the HID chunk SRAM.
+ * G_io_apdu_buffer is used by both transports and stays out of the overlay.
+ * The composite device (HAVE_USB_COMPOSITE) serves both HID interfaces at
+ * once, the U2F buffers are then regular globals.
+ */
+
+#if defined(HAVE_U2F) && !defined(HAVE_USB_COMPOSITE)
+
+#include "u2f_transport.h"
+
+typedef struct u2f_overlay_s {
+    // U2F message reassembly and response
+    unsigned char message[U2F_MAX_MESSAGE_SIZE];
+    // outgoing report, filled from the message
+    unsigned char segment[MAX_SEGMENT_SIZE];
+} u2f_overlay_t;
+
+#define IO_OVERLAY_APP_MEMBERS(X) X(u2f, u2f_overlay_t, IO_PHASE_U2F)
+
+#define u2fMessageBuffer (G_io_overlay.u2f.message)
+#define u2fSegment (G_io_overlay.u2f.segment)
+
+#else // HAVE_U2F && !HAVE_USB_COMPOSITE
+
+#define IO_OVERLAY_APP_MEMBERS(X)
+
+#endif // HAVE_U2F && !HAVE_USB_COMPOSITE
+
+#endif
@@ -19,17 +19,45 @@
 #include "cx.h"
 #include <stdbool.h>
 
+#include "os_format.h"
 #include "os_io_seproxyhal.h"
+#include "os_io_trace.h"
+#include "os_nvm_cache.h"
+#include "os_nvm_kv.h"
 #include "string.h"
 
 #include "glyphs.h"
 
+#include "base58.h"
+
+#ifdef HAVE_PBKDF2_ENGINE
+#include "pbkdf2_engine.h"
+#endif
+
+#ifdef HAVE_AES_STREAM
+#include "aes_stream.h"
+#endif
+
 #ifdef HAVE_U2F
 
 #include "u2f_service.h"
 #include "u2f_transport.h"
+#include "u2f_crypto.h"
+
+#ifdef HAVE_IO_OVERLAY
+#include "os_io_overlay.h"
+#endif // HAVE_IO_OVERLAY
 
+// unless the U2F buffers are members of the I/O overlay
+#ifndef u2fMessageBuffer
 volatile unsigned char u2fMessageBuffer[U2F_MAX_MESSAGE_SIZE];
+#endif // u2fMessageBuffer
+
+#ifdef HAVE_USB_COMPOSITE
+// U2F segments are built outside of G_io_apdu_buffer, which the Ledger HID
+// interface may be filling meanwhile
+static unsigned char u2fOutputBuffer[MAX_SEGMENT_SIZE];
+#endif // HAVE_USB_COMPOSITE
 
 extern void USB_power_U2F(unsigned char enabled, unsigned char fido);
 extern bool fidoActivated;
@@ -39,11 +67,8 @@ extern bool fidoActivated;
 bagl_element_t tmp_element;
 unsigned char G_io_seproxyhal_spi_buffer[IO_SEPROXYHAL_BUFFER_SIZE_B];
 
-static const unsigned char const BASE58ALPHABET[] = {
-    '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F',
-    'G', 'H', 'J', 'K', 'L', 'M', 'N', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W',
-    'X', 'Y', 'Z', 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'm',
-    'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z'};
+// ms since power on, as reported by the last ticker event
+volatile uint32_t G_ticker_ms;
 
 // yeah, nope
 static const uint8_t const PRIVATE_KEY[] = {
@@ -54,6 +79,20 @@ static const uint8_t const PRIVATE_KEY[] = {
 #define CLA 0xE0
 #define INS_GET_PUBLIC_KEY 0x02
 #define INS_EXIT 0x03
+#define INS_PBKDF2_START 0x04
+#define INS_PBKDF2_STATUS 0x05
+#define INS_AES_INIT 0x06
+#define INS_AES_UPDATE 0x07
+#define INS_AES_STATS 0x08
+#define INS_BENCH_TRY 0x09
+#define INS_TRY_STATS 0x0A
+#define INS_STACK_INFO 0x0B
+#define INS_BENCH_HOT 0x0C
+#define INS_PIC_STATS 0x0D
+#define INS_LOG_DUMP 0x0E
+#define INS_IO_TRACE 0x0F
+#define INS_IO_RESET_STATS 0x10
+#define INS_BENCH_U2F 0x11
 
 #define OFFSET_CLA 0
 #define OFFSET_INS 1
@@ -77,50 +116,476 @@ void u2f_proxy_response(u2f_service_t *service, unsigned int tx) {
 
 #endif
 
-unsigned char encode_base58(unsigned char WIDE *in, unsigned char length,
-                            unsigned char *out, unsigned char maxoutlen) {
-    unsigned char tmp[164];
-    unsigned char buffer[164];
-    unsigned char j;
-    unsigned char startAt;
-    unsigned char zeroCount = 0;
-    if (length > sizeof(tmp)) {
-        THROW(INVALID_PARAMETER);
+#ifdef HAVE_PBKDF2_ENGINE
+
+pbkdf2_engine_t G_pbkdf2_engine;
+unsigned char G_pbkdf2_output[PBKDF2_ENGINE_BLOCK_SIZE];
+
+// iterations (4BE) | out length (1) | password length (1) | password | salt
+void pbkdf2_handle_start(void) {
+    unsigned char lc = G_io_apdu_buffer[OFFSET_LC];
+    unsigned char *data = G_io_apdu_buffer + OFFSET_CDATA;
+    uint32_t iterations;
+    unsigned char outLength;
+    unsigned char passwordLength;
+
+    if ((lc < 6) || (lc < 6 + data[5])) {
+        THROW(0x6700);
+    }
+    iterations = U4BE(data, 0);
+    outLength = data[4];
+    passwordLength = data[5];
+    // checked here rather than by pbkdf2_engine_init, which would throw a
+    // generic INVALID_PARAMETER
+    if ((outLength == 0) || (outLength > sizeof(G_pbkdf2_output)) ||
+        (iterations == 0) ||
+        (lc - 6 - passwordLength > PBKDF2_ENGINE_MAX_SALT_LENGTH)) {
+        THROW(0x6A80);
     }
-    os_memmove(tmp, in, length);
-    while ((zeroCount < length) && (tmp[zeroCount] == 0)) {
-        ++zeroCount;
-    }
-    j = 2 * length;
-    startAt = zeroCount;
-    while (startAt < length) {
-        unsigned short remainder = 0;
-        unsigned char divLoop;
-        for (divLoop = startAt; divLoop < length; divLoop++) {
-            unsigned short digit256 = (unsigned short)(tmp[divLoop] & 0xff);
-            unsigned short tmpDiv = remainder * 256 + digit256;
-            tmp[divLoop] = (unsigned char)(tmpDiv / 58);
-            remainder = (tmpDiv % 58);
+    pbkdf2_engine_init(&G_pbkdf2_engine, data + 6, passwordLength,
+                       data + 6 + passwordLength, lc - 6 - passwordLength,
+                       iterations, G_pbkdf2_output, outLength);
+}
+
+#endif
+
+#ifdef HAVE_AES_STREAM
+
+aes_stream_t G_aes_stream;
+
+#define AES_UPDATE_LAST 0x01
+
+// P1: AES_STREAM_CBC or AES_STREAM_CTR, P2: 1 to encrypt, 0 to decrypt
+// key (16, 24 or 32) | iv (16)
+void aes_handle_init(void) {
+    unsigned char lc = G_io_apdu_buffer[OFFSET_LC];
+
+    if (lc <= CX_AES_BLOCK_SIZE) {
+        THROW(0x6700);
+    }
+    aes_stream_init(&G_aes_stream, G_io_apdu_buffer[OFFSET_P1],
+                    G_io_apdu_buffer[OFFSET_P2] != 0,
+                    G_io_apdu_buffer + OFFSET_CDATA, lc - CX_AES_BLOCK_SIZE,
+                    G_io_apdu_buffer + OFFSET_CDATA + lc - CX_AES_BLOCK_SIZE);
+    aes_stream_stats_reset();
+}
+
+// P1: AES_UPDATE_LAST on the last chunk, the stream is wiped once processed
+// data is ciphered in place, then moved to the head of the response
+unsigned int aes_handle_update(void) {
+    unsigned char lc = G_io_apdu_buffer[OFFSET_LC];
+
+    if (lc == 0) {
+        THROW(0x6700);
+    }
+    aes_stream_process(&G_aes_stream, G_io_apdu_buffer + OFFSET_CDATA, lc);
+    aes_stream_stats_add(G_io_apdu_media, lc, G_ticker_ms);
+    if (G_io_apdu_buffer[OFFSET_P1] & AES_UPDATE_LAST) {
+        aes_stream_reset(&G_aes_stream);
+    }
+    os_memmove(G_io_apdu_buffer, G_io_apdu_buffer + OFFSET_CDATA, lc);
+    return lc;
+}
+
+// per media: bytes (4BE) | elapsed ms (4BE) | bytes per second (4BE)
+unsigned int aes_handle_stats(void) {
+    unsigned int media;
+    unsigned char *out = G_io_apdu_buffer;
+
+    for (media = 0; media < AES_STREAM_MEDIA_COUNT; media++) {
+        aes_stream_stats_t *stats = &aes_stream_stats[media];
+        uint32_t values[3];
+        unsigned int i;
+        values[0] = stats->bytes;
+        values[1] = stats->lastMs - stats->firstMs;
+        values[2] = aes_stream_stats_throughput(media);
+        for (i = 0; i < 3; i++) {
+            out[0] = values[i] >> 24;
+            out[1] = values[i] >> 16;
+            out[2] = values[i] >> 8;
+            out[3] = values[i];
+            out += 4;
         }
-        if (tmp[startAt] == 0) {
-            ++startAt;
+    }
+    return out - G_io_apdu_buffer;
+}
+
+#endif
+
+#ifdef HAVE_TRY_STATS
+
+#define BENCH_TRY_EMPTY 0x00
+#define BENCH_TRY_FRAME 0x01
+#define BENCH_TRY_THROW 0x02
+#define BENCH_TRY_STATUS 0x03
+
+try_stats_t G_try_stats_last;
+
+extern unsigned int _estack;
+
+// frames (4BE) | throws (4BE) | max depth (4BE) | frames stack bytes (4BE)
+unsigned int bench_try_stats_serialize(try_stats_t *stats) {
+    uint32_t values[4];
+    unsigned int i;
+    unsigned char *out = G_io_apdu_buffer;
+
+    values[0] = stats->frames;
+    values[1] = stats->throws;
+    values[2] = stats->max_depth;
+    // distance from the top of the stack to the deepest exception context
+    values[3] = stats->frames ? (unsigned int)&_estack - stats->min_frame_address
+                              : 0;
+    for (i = 0; i < 4; i++) {
+        out[0] = values[i] >> 24;
+        out[1] = values[i] >> 16;
+        out[2] = values[i] >> 8;
+        out[3] = values[i];
+        out += 4;
+    }
+    return out - G_io_apdu_buffer;
+}
+
+// accounting of the previous APDU exchange, reception and reply included
+unsigned int bench_handle_try_stats(void) {
+    return bench_try_stats_serialize(&G_try_stats_last);
+}
+
+// kept out of line so that the status path pays a real call, as the
+// dispatcher does
+__attribute__((noinline)) unsigned short bench_status(unsigned int i) {
+    return (i & 0x10000) ? 0x6D00 : 0x9000;
+}
+
+// mode (1) | iterations (2BE)
+// The host times the exchange for each mode, BENCH_TRY_EMPTY being the loop
+// and transport baseline. The response is the try_stats of the run.
+unsigned int bench_handle_try(void) {
+    unsigned char mode;
+    unsigned int iterations;
+    volatile unsigned int i;
+    volatile unsigned int sink = 0;
+
+    if (G_io_apdu_buffer[OFFSET_LC] != 3) {
+        THROW(0x6700);
+    }
+    mode = G_io_apdu_buffer[OFFSET_CDATA];
+    iterations = U2BE(G_io_apdu_buffer, OFFSET_CDATA + 1);
+
+    try_stats_reset();
+    for (i = 0; i < iterations; i++) {
+        switch (mode) {
+        case BENCH_TRY_EMPTY:
+            sink++;
+            break;
+        case BENCH_TRY_FRAME:
+            BEGIN_TRY {
+                TRY {
+                    sink++;
+                }
+                FINALLY {
+                }
+            }
+            END_TRY;
+            break;
+        case BENCH_TRY_THROW:
+            BEGIN_TRY_L(bench) {
+                TRY_L(bench) {
+                    THROW_L(bench, 0x9000);
+                }
+                CATCH_OTHER_L(bench, e) {
+                    sink += e;
+                }
+                FINALLY_L(bench) {
+                }
+            }
+            END_TRY_L(bench);
+            break;
+        case BENCH_TRY_STATUS:
+            sink += bench_status(i);
+            break;
+        default:
+            THROW(0x6A80);
+        }
+    }
+    return bench_try_stats_serialize(&G_try_stats);
+}
+
+#endif // HAVE_TRY_STATS
+
+#ifdef HAVE_STACK_PAINT
+
+// deepest stack usage seen over an APDU exchange, and the command causing it
+unsigned int G_stack_worst_usage;
+unsigned char G_stack_worst_ins;
+unsigned int G_stack_last_usage;
+
+// called once per exchange, the stack is repainted so that each command is
+// measured on its own
+void stack_account(unsigned char ins) {
+    G_stack_last_usage = os_stack_max_usage();
+    if (G_stack_last_usage > G_stack_worst_usage) {
+        G_stack_worst_usage = G_stack_last_usage;
+        G_stack_worst_ins = ins;
+    }
+    os_stack_paint();
+}
+
+// stack size (2BE) | worst usage (2BE) | worst INS (1) | last usage (2BE)
+unsigned int stack_handle_info(void) {
+    unsigned int size = os_stack_size();
+    G_io_apdu_buffer[0] = size >> 8;
+    G_io_apdu_buffer[1] = size;
+    G_io_apdu_buffer[2] = G_stack_worst_usage >> 8;
+    G_io_apdu_buffer[3] = G_stack_worst_usage;
+    G_io_apdu_buffer[4] = G_stack_worst_ins;
+    G_io_apdu_buffer[5] = G_stack_last_usage >> 8;
+    G_io_apdu_buffer[6] = G_stack_last_usage;
+    return 7;
+}
+
+#endif // HAVE_STACK_PAINT
+
+#ifdef HAVE_HOT_BENCH
+
+#define BENCH_HOT_EMPTY 0x00
+#define BENCH_HOT_BASE58 0x01
+#define BENCH_HOT_MEMMOVE 0x02
+
+// mode (1) | iterations (2BE)
+// Runs one of the HOT_SOURCES functions in a loop, the host times the
+// exchange for each mode against BENCH_HOT_EMPTY to compare build profiles.
+unsigned int bench_handle_hot(void) {
+    unsigned char mode;
+    unsigned int iterations;
+    volatile unsigned int i;
+    volatile unsigned int sink = 0;
+    unsigned char out[40];
+
+    if (G_io_apdu_buffer[OFFSET_LC] != 3) {
+        THROW(0x6700);
+    }
+    mode = G_io_apdu_buffer[OFFSET_CDATA];
+    iterations = U2BE(G_io_apdu_buffer, OFFSET_CDATA + 1);
+
+    for (i = 0; i < iterations; i++) {
+        switch (mode) {
+        case BENCH_HOT_EMPTY:
+            sink++;
+            break;
+        case BENCH_HOT_BASE58:
+            // an address sized input, version + hash160 + checksum
+            sink += encode_base58(G_io_apdu_buffer + 32, 25, out, sizeof(out));
+            break;
+        case BENCH_HOT_MEMMOVE:
+            os_memmove(G_io_apdu_buffer + 64, G_io_apdu_buffer + 128, 128);
+            break;
+        default:
+            THROW(0x6A80);
+        }
+    }
+    return 0;
+}
+
+#endif // HAVE_HOT_BENCH
+
+#ifdef HAVE_U2F_BENCH
+
+#ifndef HAVE_U2F_AUTHENTICATOR
+#error HAVE_U2F_BENCH requires HAVE_U2F_AUTHENTICATOR
+#endif // HAVE_U2F_AUTHENTICATOR
+
+#define BENCH_U2F_EMPTY 0x00
+#define BENCH_U2F_UNWRAP_DERIVE 0x01
+#define BENCH_U2F_UNWRAP 0x02
+#define BENCH_U2F_REGISTER 0x03
+#define BENCH_U2F_AUTHENTICATE 0x04
+
+// request laid out as an authentication request in G_io_apdu_buffer
+#define BENCH_U2F_REQUEST 32
+#define BENCH_U2F_KEY_HANDLE (BENCH_U2F_REQUEST + 32 + 32 + 1)
+#define BENCH_U2F_RESPONSE (BENCH_U2F_KEY_HANDLE + U2F_KEY_HANDLE_SIZE)
+
+typedef char bench_u2f_response_must_fit_the_apdu_buffer
+    [(BENCH_U2F_RESPONSE + U2F_AUTHENTICATE_MAX_SIZE <= IO_APDU_BUFFER_SIZE)
+         ? 1
+         : -1];
+
+// mode (1) | iterations (2BE)
+// Runs the U2F operations without the transport, the host times the
+// exchange for each mode against BENCH_U2F_EMPTY. Registrations are built in
+// the U2F message buffer (no U2F client must be running), authentications
+// advance the signature counter, committed at each iteration as with each
+// U2F reply: a counter update takes a page of its own, a batch of
+// iterations would overflow the NVRAM cache.
+unsigned int bench_handle_u2f(void) {
+    unsigned char mode;
+    unsigned int iterations;
+    volatile unsigned int i;
+    volatile unsigned int sink = 0;
+    unsigned char privateKey[32];
+    unsigned char *request = G_io_apdu_buffer + BENCH_U2F_REQUEST;
+    unsigned char *keyHandle = G_io_apdu_buffer + BENCH_U2F_KEY_HANDLE;
+
+    if (G_io_apdu_buffer[OFFSET_LC] != 3) {
+        THROW(0x6700);
+    }
+    mode = G_io_apdu_buffer[OFFSET_CDATA];
+    iterations = U2BE(G_io_apdu_buffer, OFFSET_CDATA + 1);
+
+    // a random scalar is below the P-256 order with overwhelming probability
+    cx_rng(privateKey, sizeof(privateKey));
+    request[64] = U2F_KEY_HANDLE_SIZE;
+    u2f_crypto_wrap(privateKey, keyHandle);
+
+    for (i = 0; i < iterations; i++) {
+        switch (mode) {
+        case BENCH_U2F_EMPTY:
+            sink++;
+            break;
+        case BENCH_U2F_UNWRAP_DERIVE:
+            // first operation of a session
+            u2f_crypto_reset();
+            sink += u2f_crypto_unwrap(keyHandle, privateKey);
+            break;
+        case BENCH_U2F_UNWRAP:
+            sink += u2f_crypto_unwrap(keyHandle, privateKey);
+            break;
+        case BENCH_U2F_REGISTER:
+            sink += u2f_crypto_register(request, request + 32,
+                                        (unsigned char *)u2fMessageBuffer);
+            break;
+        case BENCH_U2F_AUTHENTICATE:
+            u2f_crypto_unwrap(keyHandle, privateKey);
+            sink += u2f_crypto_authenticate(privateKey, request, request + 32,
+                                            G_io_apdu_buffer +
+                                                BENCH_U2F_RESPONSE);
+#ifdef HAVE_NVM_CACHE
+            nvm_cache_commit();
+#endif // HAVE_NVM_CACHE
+            break;
+        default:
+            os_memset(privateKey, 0, sizeof(privateKey));
+            THROW(0x6A80);
         }
-        buffer[--j] = (unsigned char)BASE58ALPHABET[remainder];
     }
-    while ((j < (2 * length)) && (buffer[j] == BASE58ALPHABET[0])) {
-        ++j;
+    os_memset(privateKey, 0, sizeof(privateKey));
+    return 0;
+}
+
+#endif // HAVE_U2F_BENCH
+
+#ifdef HAVE_PIC_STATS
+
+// pic() calls (4BE) | translations (4BE) | redraws (4BE)
+// Counted since the previous INS_PIC_STATS with P1 = 1, which resets them.
+unsigned int pic_handle_stats(void) {
+    uint32_t values[3];
+    unsigned int i;
+    unsigned char *out = G_io_apdu_buffer;
+
+    values[0] = G_pic_stats.calls;
+    values[1] = G_pic_stats.translations;
+    values[2] = G_pic_stats.redraws;
+    if (G_io_apdu_buffer[OFFSET_P1] == 1) {
+        os_memset(&G_pic_stats, 0, sizeof(G_pic_stats));
     }
-    while (zeroCount-- > 0) {
-        buffer[--j] = BASE58ALPHABET[0];
+    for (i = 0; i < 3; i++) {
+        out[0] = values[i] >> 24;
+        out[1] = values[i] >> 16;
+        out[2] = values[i] >> 8;
+        out[3] = values[i];
+        out += 4;
     }
-    length = 2 * length - j;
-    if (maxoutlen < length) {
-        THROW(EXCEPTION_OVERFLOW);
+    return out - G_io_apdu_buffer;
+}
+
+#endif // HAVE_PIC_STATS
+
+#ifdef HAVE_LOG_RING
+
+// bytes ever logged (4BE) | the most recent records, oldest first
+unsigned int log_handle_dump(void) {
+    uint32_t written = G_log_ring.written;
+    G_io_apdu_buffer[0] = written >> 24;
+    G_io_apdu_buffer[1] = written >> 16;
+    G_io_apdu_buffer[2] = written >> 8;
+    G_io_apdu_buffer[3] = written;
+    // room kept for the status word
+    return 4 + log_ring_read(G_io_apdu_buffer + 4,
+                             sizeof(G_io_apdu_buffer) - 4 - 2);
+}
+
+#endif // HAVE_LOG_RING
+
+#ifdef HAVE_IO_WARM_RESET
+
+#define IO_RESET_COLD 0
+#define IO_RESET_WARM 1
+
+// EXCEPTION_IO_RESET recoveries, per kind, the recovery time being from the
+// reset to the next command, at the ticker resolution
+typedef struct io_reset_stats_s {
+    // ticker ms of the last reset
+    uint32_t reset_ms;
+    uint16_t count[2];
+    uint16_t last_ms[2];
+    uint16_t max_ms[2];
+    uint8_t kind;
+    // reset done, next command not received yet
+    uint8_t pending;
+} io_reset_stats_t;
+
+io_reset_stats_t G_io_reset_stats;
+
+void io_reset_stats_start(unsigned int kind) {
+    G_io_reset_stats.count[kind]++;
+    G_io_reset_stats.kind = kind;
+    G_io_reset_stats.pending = 1;
+    G_io_reset_stats.reset_ms = G_ticker_ms;
+}
+
+void io_reset_stats_command(void) {
+    uint32_t elapsed;
+    unsigned int kind = G_io_reset_stats.kind;
+
+    if (!G_io_reset_stats.pending) {
+        return;
+    }
+    G_io_reset_stats.pending = 0;
+    elapsed = G_ticker_ms - G_io_reset_stats.reset_ms;
+    if (elapsed > 0xFFFF) {
+        elapsed = 0xFFFF;
+    }
+    G_io_reset_stats.last_ms[kind] = elapsed;
+    if (elapsed > G_io_reset_stats.max_ms[kind]) {
+        G_io_reset_stats.max_ms[kind] = elapsed;
     }
-    os_memmove(out, (buffer + j), length);
-    return length;
 }
 
+// cold then warm resets, each as count (2BE) | last recovery ms (2BE) | max
+// recovery ms (2BE). Reset with P1 = 1.
+unsigned int io_reset_handle_stats(void) {
+    unsigned int kind;
+    unsigned char *out = G_io_apdu_buffer;
+    io_reset_stats_t stats = G_io_reset_stats;
+
+    if (G_io_apdu_buffer[OFFSET_P1] == 1) {
+        os_memset(&G_io_reset_stats, 0, sizeof(G_io_reset_stats));
+    }
+    for (kind = IO_RESET_COLD; kind <= IO_RESET_WARM; kind++) {
+        out[0] = stats.count[kind] >> 8;
+        out[1] = stats.count[kind];
+        out[2] = stats.last_ms[kind] >> 8;
+        out[3] = stats.last_ms[kind];
+        out[4] = stats.max_ms[kind] >> 8;
+        out[5] = stats.max_ms[kind];
+        out += 6;
+    }
+    return out - G_io_apdu_buffer;
+}
+
+#endif // HAVE_IO_WARM_RESET
+
 void public_key_hash160(unsigned char WIDE *in, unsigned short inlen,
                         unsigned char *out) {
     union {
@@ -197,69 +662,167 @@ unsigned short io_exchange_al(unsigned char channel, unsigned short tx_len) {
     return 0;
 }
 
+unsigned short exception_to_sw(unsigned short e) {
+    switch (e & 0xF000) {
+    case 0x6000:
+        // Wipe the transaction context and report the exception
+    case 0x9000:
+        // All is well
+        return e;
+    default:
+        // Internal error
+        return 0x6800 | (e & 0x7FF);
+    }
+}
+
+// Hot path dispatcher: the status word is returned, no exception frame is
+// opened. Exceptions thrown by the handlers or the syscalls are caught by the
+// caller's frame.
+unsigned short handleApduStatus(volatile unsigned int *flags,
+                                volatile unsigned int *tx) {
+#ifdef HAVE_IO_WARM_RESET
+    // U2F and HID commands both end up here
+    io_reset_stats_command();
+#endif // HAVE_IO_WARM_RESET
+
+    if (G_io_apdu_buffer[OFFSET_CLA] != CLA) {
+        return 0x6E00;
+    }
+
+    switch (G_io_apdu_buffer[OFFSET_INS]) {
+    case INS_GET_PUBLIC_KEY: {
+        cx_ecfp_public_key_t publicKey;
+        cx_ecfp_private_key_t privateKey;
+        cx_ecfp_init_private_key(CX_CURVE_256K1, PRIVATE_KEY, 32, &privateKey);
+        cx_ecfp_generate_pair(CX_CURVE_256K1, &publicKey, &privateKey, 1);
+        compress_public_key_value(publicKey.W);
+        *tx = public_key_to_encoded_base58(publicKey.W, 33, G_io_apdu_buffer,
+                                           100, 0, 0);
+        return 0x9000;
+    }
+
+    case INS_EXIT:
+        os_sched_exit(0);
+        return 0x9000;
+
+#ifdef HAVE_PBKDF2_ENGINE
+    case INS_PBKDF2_START:
+        pbkdf2_handle_start();
+        return 0x9000;
+
+    // progress (2BE, per mille) | derived key once complete
+    case INS_PBKDF2_STATUS: {
+        unsigned int progress = pbkdf2_engine_progress(&G_pbkdf2_engine);
+        G_io_apdu_buffer[0] = progress >> 8;
+        G_io_apdu_buffer[1] = progress;
+        *tx = 2;
+        if (G_pbkdf2_engine.state == PBKDF2_ENGINE_DONE) {
+            os_memmove(G_io_apdu_buffer + 2, G_pbkdf2_output,
+                       G_pbkdf2_engine.outLength);
+            *tx += G_pbkdf2_engine.outLength;
+        }
+        return 0x9000;
+    }
+#endif // HAVE_PBKDF2_ENGINE
+
+#ifdef HAVE_AES_STREAM
+    case INS_AES_INIT:
+        aes_handle_init();
+        return 0x9000;
+
+    case INS_AES_UPDATE:
+        *tx = aes_handle_update();
+        return 0x9000;
+
+    case INS_AES_STATS:
+        *tx = aes_handle_stats();
+        return 0x9000;
+#endif // HAVE_AES_STREAM
+
+#ifdef HAVE_TRY_STATS
+    case INS_BENCH_TRY:
+        *tx = bench_handle_try();
+        return 0x9000;
+
+    case INS_TRY_STATS:
+        *tx = bench_handle_try_stats();
+        return 0x9000;
+#endif // HAVE_TRY_STATS
+
+#ifdef HAVE_STACK_PAINT
+    case INS_STACK_INFO:
+        *tx = stack_handle_info();
+        return 0x9000;
+#endif // HAVE_STACK_PAINT
+
+#ifdef HAVE_HOT_BENCH
+    case INS_BENCH_HOT:
+        *tx = bench_handle_hot();
+        return 0x9000;
+#endif // HAVE_HOT_BENCH
+
+#ifdef HAVE_U2F_BENCH
+    case INS_BENCH_U2F:
+        *tx = bench_handle_u2f();
+        return 0x9000;
+#endif // HAVE_U2F_BENCH
+
+#ifdef HAVE_PIC_STATS
+    case INS_PIC_STATS:
+        *tx = pic_handle_stats();
+        return 0x9000;
+#endif // HAVE_PIC_STATS
+
+#ifdef HAVE_LOG_RING
+    case INS_LOG_DUMP:
+        *tx = log_handle_dump();
+        return 0x9000;
+#endif // HAVE_LOG_RING
+
+#ifdef HAVE_IO_TRACE
+    case INS_IO_TRACE:
+        // room kept for the status word
+        *tx = io_trace_dump(G_io_apdu_buffer, sizeof(G_io_apdu_buffer) - 2);
+        return 0x9000;
+#endif // HAVE_IO_TRACE
+
+#ifdef HAVE_IO_WARM_RESET
+    case INS_IO_RESET_STATS:
+        *tx = io_reset_handle_stats();
+        return 0x9000;
+#endif // HAVE_IO_WARM_RESET
+
+    default:
+        return 0x6D00;
+    }
+}
+
+// Entry point for callers without an exception frame of their own (the U2F
+// proxy), the status word is appended to the response.
 void handleApdu(volatile unsigned int *flags, volatile unsigned int *tx) {
     unsigned short sw = 0;
 
     BEGIN_TRY {
         TRY {
-            if (G_io_apdu_buffer[OFFSET_CLA] != CLA) {
-                THROW(0x6E00);
-            }
-
-            switch (G_io_apdu_buffer[OFFSET_INS]) {
-            case INS_GET_PUBLIC_KEY: {
-                cx_ecfp_public_key_t publicKey;
-                cx_ecfp_private_key_t privateKey;
-                cx_ecfp_init_private_key(CX_CURVE_256K1, PRIVATE_KEY, 32,
-                                         &privateKey);
-                cx_ecfp_generate_pair(CX_CURVE_256K1, &publicKey, &privateKey,
-                                      1);
-                compress_public_key_value(publicKey.W);
-                *tx = public_key_to_encoded_base58(publicKey.W, 33,
-                                                   G_io_apdu_buffer, 100, 0, 0);
-                THROW(0x9000);
-            } break;
-
-            case INS_EXIT:
-                os_sched_exit(0);
-                THROW(0x9000);
-                break;
-
-            default:
-                THROW(0x6D00);
-                break;
-            }
+            sw = handleApduStatus(flags, tx);
         }
         CATCH_OTHER(e) {
-            switch (e & 0xF000) {
-            case 0x6000:
-                // Wipe the transaction context and report the exception
-                sw = e;
-                break;
-            case 0x9000:
-                // All is well
-                sw = e;
-                break;
-            default:
-                // Internal error
-                sw = 0x6800 | (e & 0x7FF);
-                break;
-            }
-            // Unexpected exception => report
-            G_io_apdu_buffer[*tx] = sw >> 8;
-            G_io_apdu_buffer[*tx + 1] = sw;
-            *tx += 2;
+            sw = exception_to_sw(e);
         }
         FINALLY {
         }
     }
     END_TRY;
+    G_io_apdu_buffer[*tx] = sw >> 8;
+    G_io_apdu_buffer[*tx + 1] = sw;
+    *tx += 2;
 }
 
 void sample_main(void) {
     volatile unsigned int rx = 0;
     volatile unsigned int tx = 0;
     volatile unsigned int flags = 0;
+    volatile unsigned char ins = 0;
 
     // DESIGN NOTE: the bootloader ignores the way APDU are fetched. The only
     // goal is to retrieve APDU.
@@ -270,6 +833,19 @@ void sample_main(void) {
     for (;;) {
         volatile unsigned short sw = 0;
 
+#ifdef HAVE_TRY_STATS
+        // the previous exchange accounting is kept for INS_TRY_STATS
+        G_try_stats_last = G_try_stats;
+        try_stats_reset();
+#endif // HAVE_TRY_STATS
+
+#ifdef HAVE_STACK_PAINT
+        // the previous exchange is accounted to the command it received
+        stack_account(ins);
+#endif // HAVE_STACK_PAINT
+
+        // single frame per APDU, the dispatcher reports through its return
+        // value and only errors unwind here
         BEGIN_TRY {
             TRY {
                 rx = tx;
@@ -284,32 +860,32 @@ void sample_main(void) {
                     THROW(0x6982);
                 }
 
-                handleApdu(&flags, &tx);
+                ins = G_io_apdu_buffer[OFFSET_INS];
+                sw = handleApduStatus(&flags, &tx);
+            }
+            CATCH(EXCEPTION_IO_RESET) {
+                // warm or cold transport reset, decided by main()
+                THROW(EXCEPTION_IO_RESET);
             }
             CATCH_OTHER(e) {
-                switch (e & 0xF000) {
-                case 0x6000:
-                    // Wipe the transaction context and report the exception
-                    sw = e;
-                    break;
-                case 0x9000:
-                    // All is well
-                    sw = e;
-                    break;
-                default:
-                    // Internal error
-                    sw = 0x6800 | (e & 0x7FF);
-                    break;
-                }
                 // Unexpected exception => report
-                G_io_apdu_buffer[tx] = sw >> 8;
-                G_io_apdu_buffer[tx + 1] = sw;
-                tx += 2;
+                sw = exception_to_sw(e);
+                LOG(F_STR("ins ") F_X8(ins) F_STR(" exception ") F_X16(e));
+#ifdef HAVE_NVM_CACHE
+                // the failed command leaves the NVRAM untouched
+                nvm_cache_discard();
+#ifdef HAVE_NVM_KV
+                nvm_kv_init();
+#endif // HAVE_NVM_KV
+#endif // HAVE_NVM_CACHE
             }
             FINALLY {
             }
         }
         END_TRY;
+        G_io_apdu_buffer[tx] = sw >> 8;
+        G_io_apdu_buffer[tx + 1] = sw;
+        tx += 2;
     }
 
     // return_to_dashboard:
@@ -326,10 +902,33 @@ unsigned char io_event(unsigned char channel) {
 
     // can't have more than one tag in the reply, not supported yet.
     switch (G_io_seproxyhal_spi_buffer[0]) {
+    case SEPROXYHAL_TAG_TICKER_EVENT:
+        G_ticker_ms = U4BE(G_io_seproxyhal_spi_buffer, 3);
+#ifdef HAVE_PBKDF2_ENGINE
+        // bounded amount of work per tick to keep io_exchange responsive
+        pbkdf2_engine_step(&G_pbkdf2_engine,
+                           PBKDF2_ENGINE_ITERATIONS_PER_STEP);
+#endif // HAVE_PBKDF2_ENGINE
+#if defined(HAVE_NVM_KV) && defined(HAVE_NVM_CACHE)
+        // store compaction, committed on its own, out of the batch of a
+        // command being processed
+        if (!nvm_cache_dirty()) {
+            nvm_kv_step();
+            nvm_cache_commit();
+        }
+#elif defined(HAVE_NVM_KV)
+        // store compaction, at most a page program per tick
+        nvm_kv_step();
+#endif // HAVE_NVM_KV
+        break;
+
     case SEPROXYHAL_TAG_STATUS_EVENT:
         if (G_io_apdu_media == IO_APDU_MEDIA_USB_HID &&
             !(U4BE(G_io_seproxyhal_spi_buffer, 3) &
               SEPROXYHAL_TAG_STATUS_EVENT_FLAG_USB_POWERED)) {
+#ifdef HAVE_IO_WARM_RESET
+            G_io_reset_flags |= IO_RESET_FLAG_USB_UNPOWERED;
+#endif // HAVE_IO_WARM_RESET
             THROW(EXCEPTION_IO_RESET);
         }
     // no break is intentional
@@ -357,35 +956,77 @@ void app_exit(void) {
     END_TRY_L(exit);
 }
 
+// full IO init, the host enumerates the device
+void io_power_on(void) {
+    io_seproxyhal_init();
+
+    // no ux in this app, the ticker is the app time base
+    io_seproxyhal_setup_ticker(100);
+
+#ifdef HAVE_U2F
+    os_memset((unsigned char *)&u2fService, 0, sizeof(u2fService));
+    u2fService.inputBuffer = G_io_apdu_buffer;
+#ifdef HAVE_USB_COMPOSITE
+    u2fService.outputBuffer = u2fOutputBuffer;
+#else  // HAVE_USB_COMPOSITE
+    u2fService.outputBuffer = G_io_apdu_buffer;
+#endif // HAVE_USB_COMPOSITE
+    u2fService.messageBuffer = (uint8_t *)u2fMessageBuffer;
+    u2fService.messageBufferSize = U2F_MAX_MESSAGE_SIZE;
+    u2f_initialize_service((u2f_service_t *)&u2fService);
+
+    USB_power_U2F(1, 1);
+#else  // HAVE_U2F
+    USB_power_U2F(1, 0);
+#endif // HAVE_U2F
+}
+
 __attribute__((section(".boot"))) int main(void) {
+    volatile unsigned char io_reset = 0;
+
     // exit critical section
     __asm volatile("cpsie i");
 
     // ensure exception will work as planned
     os_boot();
 
+#ifdef HAVE_NVM_CACHE
+    // complete a batch interrupted by a power loss before reading the NVRAM
+    nvm_cache_init();
+#endif // HAVE_NVM_CACHE
+#ifdef HAVE_NVM_KV
+    nvm_kv_init();
+#endif // HAVE_NVM_KV
+#ifdef HAVE_NVM_CACHE
+    nvm_cache_commit();
+#endif // HAVE_NVM_CACHE
+
     for (;;) {
         BEGIN_TRY {
             TRY {
-                io_seproxyhal_init();
-
+#ifdef HAVE_IO_WARM_RESET
+                if (!io_reset) {
+                    io_power_on();
+                } else if (io_seproxyhal_warm_reset()) {
+                    // the device stays configured, U2F channels are kept
+                    io_reset_stats_start(IO_RESET_WARM);
 #ifdef HAVE_U2F
-                os_memset((unsigned char *)&u2fService, 0, sizeof(u2fService));
-                u2fService.inputBuffer = G_io_apdu_buffer;
-                u2fService.outputBuffer = G_io_apdu_buffer;
-                u2fService.messageBuffer = (uint8_t *)u2fMessageBuffer;
-                u2fService.messageBufferSize = U2F_MAX_MESSAGE_SIZE;
-                u2f_initialize_service((u2f_service_t *)&u2fService);
-
-                USB_power_U2F(1, 1);
-#else  // HAVE_U2F
-                USB_power_U2F(1, 0);
+                    u2f_reset((u2f_service_t *)&u2fService, false);
 #endif // HAVE_U2F
+                } else {
+                    io_reset_stats_start(IO_RESET_COLD);
+                    io_power_on();
+                }
+#else  // HAVE_IO_WARM_RESET
+                io_power_on();
+#endif // HAVE_IO_WARM_RESET
 
                 sample_main();
             }
             CATCH(EXCEPTION_IO_RESET) {
+                LOG(F_STR("io reset"));
                 // reset IO and UX
+                io_reset = 1;
                 continue;
             }
             CATCH_ALL {
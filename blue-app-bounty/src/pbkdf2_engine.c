@@ -0,0 +1,126 @@
+/*******************************************************************************
+*   Simple bountry
+*   (c) 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#include "pbkdf2_engine.h"
+
+#ifdef HAVE_PBKDF2_ENGINE
+
+void pbkdf2_engine_init(pbkdf2_engine_t *engine, const uint8_t *password,
+                        uint16_t passwordLength, const uint8_t *salt,
+                        uint8_t saltLength, uint32_t iterations, uint8_t *out,
+                        uint16_t outLength) {
+    if ((saltLength > PBKDF2_ENGINE_MAX_SALT_LENGTH) || (iterations == 0) ||
+        (outLength == 0)) {
+        THROW(INVALID_PARAMETER);
+    }
+    pbkdf2_engine_reset(engine);
+    cx_hmac_sha512_init(&engine->hmac, (unsigned char *)password,
+                        passwordLength);
+    os_memmove(engine->salt, salt, saltLength);
+    engine->saltLength = saltLength;
+    engine->out = out;
+    engine->outLength = outLength;
+    engine->iterations = iterations;
+    engine->block = 1;
+    engine->state = PBKDF2_ENGINE_RUNNING;
+}
+
+unsigned int pbkdf2_engine_step(pbkdf2_engine_t *engine,
+                                unsigned int maxIterations) {
+    uint8_t blockIndex[4];
+    uint16_t chunk;
+
+    if (engine->state != PBKDF2_ENGINE_RUNNING) {
+        return (engine->state == PBKDF2_ENGINE_DONE);
+    }
+
+    while (maxIterations--) {
+        if (engine->iteration == 0) {
+            // U1 = PRF(P, S || INT(i))
+            blockIndex[0] = engine->block >> 24;
+            blockIndex[1] = engine->block >> 16;
+            blockIndex[2] = engine->block >> 8;
+            blockIndex[3] = engine->block;
+            cx_hmac((cx_hmac_t *)&engine->hmac, 0, engine->salt,
+                    engine->saltLength, NULL);
+            cx_hmac((cx_hmac_t *)&engine->hmac, CX_LAST, blockIndex,
+                    sizeof(blockIndex), engine->u);
+            os_memmove(engine->t, engine->u, sizeof(engine->t));
+        } else {
+            // Uj = PRF(P, Uj-1)
+            cx_hmac((cx_hmac_t *)&engine->hmac, CX_LAST, engine->u,
+                    sizeof(engine->u), engine->u);
+            os_xor(engine->t, engine->t, engine->u, sizeof(engine->t));
+        }
+
+        if (++engine->iteration != engine->iterations) {
+            continue;
+        }
+
+        // block complete, flush T(i)
+        chunk = engine->outLength - engine->outOffset;
+        if (chunk > PBKDF2_ENGINE_BLOCK_SIZE) {
+            chunk = PBKDF2_ENGINE_BLOCK_SIZE;
+        }
+        os_memmove(engine->out + engine->outOffset, engine->t, chunk);
+        engine->outOffset += chunk;
+        engine->iteration = 0;
+        engine->block++;
+
+        if (engine->outOffset == engine->outLength) {
+            // only the output is kept
+            os_memset(&engine->hmac, 0, sizeof(engine->hmac));
+            os_memset(engine->u, 0, sizeof(engine->u));
+            os_memset(engine->t, 0, sizeof(engine->t));
+            engine->state = PBKDF2_ENGINE_DONE;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+unsigned int pbkdf2_engine_progress(pbkdf2_engine_t *engine) {
+    uint32_t total;
+    uint32_t done;
+
+    switch (engine->state) {
+    case PBKDF2_ENGINE_DONE:
+        return 1000;
+    case PBKDF2_ENGINE_RUNNING:
+        break;
+    default:
+        return 0;
+    }
+
+    total = ((engine->outLength + PBKDF2_ENGINE_BLOCK_SIZE - 1) /
+             PBKDF2_ENGINE_BLOCK_SIZE) *
+            engine->iterations;
+    done = (engine->block - 1) * engine->iterations + engine->iteration;
+    // keep done * 1000 within 32 bits
+    while (total > 0x3FFFFF) {
+        total >>= 1;
+        done >>= 1;
+    }
+    return (done * 1000) / total;
+}
+
+void pbkdf2_engine_reset(pbkdf2_engine_t *engine) {
+    os_memset(engine, 0, sizeof(pbkdf2_engine_t));
+    engine->state = PBKDF2_ENGINE_IDLE;
+}
+
+#endif
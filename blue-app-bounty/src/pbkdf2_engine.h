@@ -0,0 +1,96 @@
+/*******************************************************************************
+*   Simple bountry
+*   (c) 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#ifndef __PBKDF2_ENGINE_H__
+
+#define __PBKDF2_ENGINE_H__
+
+#include <stdint.h>
+
+#include "os.h"
+#include "cx.h"
+
+/**
+ * Resumable PBKDF2-HMAC-SHA512 (RFC 2898).
+ * Unlike cx_pbkdf2_sha512, the derivation is split in bounded steps so that
+ * it can be driven from the ticker event without starving io_exchange.
+ */
+
+#ifndef PBKDF2_ENGINE_MAX_SALT_LENGTH
+#define PBKDF2_ENGINE_MAX_SALT_LENGTH 64
+#endif
+
+#ifndef PBKDF2_ENGINE_ITERATIONS_PER_STEP
+#define PBKDF2_ENGINE_ITERATIONS_PER_STEP 32
+#endif
+
+#define PBKDF2_ENGINE_BLOCK_SIZE 64
+
+typedef enum {
+    PBKDF2_ENGINE_IDLE,
+    PBKDF2_ENGINE_RUNNING,
+    PBKDF2_ENGINE_DONE
+} pbkdf2_engine_state_t;
+
+typedef struct pbkdf2_engine_s {
+    // password is kept as the hmac key, context is reinited on each CX_LAST
+    cx_hmac_sha512_t hmac;
+    // U(j) of the current block
+    uint8_t u[PBKDF2_ENGINE_BLOCK_SIZE];
+    // T(i) accumulator of the current block
+    uint8_t t[PBKDF2_ENGINE_BLOCK_SIZE];
+    uint8_t salt[PBKDF2_ENGINE_MAX_SALT_LENGTH];
+    uint8_t saltLength;
+    uint8_t *out;
+    uint16_t outLength;
+    uint16_t outOffset;
+    // 1 based block index, as hashed with the salt
+    uint32_t block;
+    uint32_t iterations;
+    // iterations already performed in the current block
+    uint32_t iteration;
+    pbkdf2_engine_state_t state;
+} pbkdf2_engine_t;
+
+/**
+ * Prepare a derivation. Nothing is computed until pbkdf2_engine_step is
+ * called. The out buffer must stay valid until the derivation is done.
+ * @throws INVALID_PARAMETER
+ */
+void pbkdf2_engine_init(pbkdf2_engine_t *engine, const uint8_t *password,
+                        uint16_t passwordLength, const uint8_t *salt,
+                        uint8_t saltLength, uint32_t iterations, uint8_t *out,
+                        uint16_t outLength);
+
+/**
+ * Perform at most maxIterations hmac iterations.
+ * @return 1 when the derivation is complete, 0 otherwise
+ */
+unsigned int pbkdf2_engine_step(pbkdf2_engine_t *engine,
+                                unsigned int maxIterations);
+
+/**
+ * @return the completed work in per mille
+ */
+unsigned int pbkdf2_engine_progress(pbkdf2_engine_t *engine);
+
+/**
+ * Abort the derivation and wipe the intermediate values.
+ */
+void pbkdf2_engine_reset(pbkdf2_engine_t *engine);
+
+#endif
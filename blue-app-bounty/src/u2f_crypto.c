@@ -0,0 +1,239 @@
+#ifdef HAVE_U2F
+
+/*
+*******************************************************************************
+*   Portable FIDO U2F implementation
+*   (c) 2016 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*   limitations under the License.
+********************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+#include "os.h"
+#include "cx.h"
+#include "os_nvm_kv.h"
+#include "u2f_crypto.h"
+
+#ifdef HAVE_U2F_AUTHENTICATOR
+
+#ifndef HAVE_NVM_KV
+#error HAVE_U2F_AUTHENTICATOR requires HAVE_NVM_KV (signature counter)
+#endif // HAVE_NVM_KV
+
+#if !defined(HAVE_U2F_BENCH) || !defined(HAVE_U2F_DEV_ATTESTATION)
+#error HAVE_U2F_AUTHENTICATOR is for bench and development builds only, it requires HAVE_U2F_BENCH and HAVE_U2F_DEV_ATTESTATION (see u2f_crypto.h)
+#endif // !HAVE_U2F_BENCH || !HAVE_U2F_DEV_ATTESTATION
+
+typedef char u2f_counter_key_must_be_a_kv_key
+    [(U2F_COUNTER_KEY <= NVM_KV_MAX_KEYS) ? 1 : -1];
+typedef char u2f_registration_must_fit_the_message_buffer
+    [(U2F_REGISTER_MAX_SIZE + 2 <= U2F_MAX_MESSAGE_SIZE) ? 1 : -1];
+
+#define U2F_REGISTER_RESERVED 0x05
+#define U2F_REGISTER_HASH_ID 0x00
+// no user presence check yet, the flag is left clear
+#define U2F_USER_PRESENCE 0x00
+
+#define U2F_KEY_HANDLE_IV 0
+#define U2F_KEY_HANDLE_KEY (U2F_KEY_HANDLE_IV + CX_AES_BLOCK_SIZE)
+#define U2F_KEY_HANDLE_MAC (U2F_KEY_HANDLE_KEY + 32)
+#define U2F_KEY_HANDLE_MAC_SIZE 16
+// application parameter and key handle length, see u2f_crypto.h
+#define U2F_KEY_HANDLE_PREFIX (32 + 1)
+
+typedef char u2f_key_handle_size_mismatch
+    [(U2F_KEY_HANDLE_MAC + U2F_KEY_HANDLE_MAC_SIZE == U2F_KEY_HANDLE_SIZE)
+         ? 1
+         : -1];
+
+// hardened 'U2F' node of the device seed
+static const unsigned int U2F_WRAP_PATH[] = {0x80000000 | 0x553246};
+
+#ifdef HAVE_U2F_DEV_ATTESTATION
+// development attestation key, public: a production device needs a
+// provisioned batch key and certificate
+static const uint8_t U2F_ATTESTATION_KEY[] = {
+    0x1b, 0x1d, 0x61, 0x99, 0xde, 0x03, 0x32, 0x45, 0x0c, 0xff, 0x51, 0x78,
+    0x88, 0x6d, 0x60, 0xe4, 0x85, 0xa6, 0xb2, 0x5a, 0x2e, 0x67, 0xbf, 0xe0,
+    0x36, 0x6f, 0x87, 0x95, 0x3a, 0xfb, 0xda, 0x5b,
+};
+#endif // HAVE_U2F_DEV_ATTESTATION
+
+typedef struct u2f_wrap_keys_s {
+    uint8_t encryption[16];
+    uint8_t authentication[32];
+    bool ready;
+} u2f_wrap_keys_t;
+
+// the derivation is the slowest step of a registration or authentication,
+// it is done once per session
+static u2f_wrap_keys_t u2fWrapKeys;
+
+static void u2f_crypto_derive_wrap_keys(void) {
+    uint8_t privateKey[32];
+    uint8_t chain[32];
+
+    if (u2fWrapKeys.ready) {
+        return;
+    }
+    os_perso_derive_node_bip32(
+        CX_CURVE_256R1, (unsigned int *)U2F_WRAP_PATH,
+        sizeof(U2F_WRAP_PATH) / sizeof(U2F_WRAP_PATH[0]), privateKey, chain);
+    os_memmove(u2fWrapKeys.encryption, chain, sizeof(u2fWrapKeys.encryption));
+    os_memmove(u2fWrapKeys.authentication, privateKey,
+               sizeof(u2fWrapKeys.authentication));
+    os_memset(privateKey, 0, sizeof(privateKey));
+    os_memset(chain, 0, sizeof(chain));
+    u2fWrapKeys.ready = true;
+}
+
+void u2f_crypto_reset(void) {
+    os_memset(&u2fWrapKeys, 0, sizeof(u2fWrapKeys));
+}
+
+static void u2f_crypto_mac(uint8_t *keyHandle, uint8_t *mac) {
+    uint8_t digest[32];
+    cx_hmac_sha256(u2fWrapKeys.authentication,
+                   sizeof(u2fWrapKeys.authentication),
+                   keyHandle - U2F_KEY_HANDLE_PREFIX,
+                   U2F_KEY_HANDLE_PREFIX + U2F_KEY_HANDLE_MAC, digest);
+    os_memmove(mac, digest, U2F_KEY_HANDLE_MAC_SIZE);
+}
+
+void u2f_crypto_wrap(uint8_t *privateKey, uint8_t *keyHandle) {
+    cx_aes_key_t key;
+    uint8_t iv[CX_AES_BLOCK_SIZE];
+
+    u2f_crypto_derive_wrap_keys();
+    cx_rng(iv, sizeof(iv));
+    os_memmove(keyHandle + U2F_KEY_HANDLE_IV, iv, sizeof(iv));
+    cx_aes_init_key(u2fWrapKeys.encryption, sizeof(u2fWrapKeys.encryption),
+                    &key);
+    cx_aes_iv(&key, CX_LAST | CX_ENCRYPT | CX_CHAIN_CBC | CX_PAD_NONE, iv,
+              privateKey, 32, keyHandle + U2F_KEY_HANDLE_KEY);
+    os_memset(&key, 0, sizeof(key));
+    u2f_crypto_mac(keyHandle, keyHandle + U2F_KEY_HANDLE_MAC);
+}
+
+bool u2f_crypto_unwrap(uint8_t *keyHandle, uint8_t *privateKey) {
+    cx_aes_key_t key;
+    uint8_t iv[CX_AES_BLOCK_SIZE];
+    uint8_t mac[U2F_KEY_HANDLE_MAC_SIZE];
+    uint8_t diff = 0;
+    uint8_t i;
+
+    u2f_crypto_derive_wrap_keys();
+    u2f_crypto_mac(keyHandle, mac);
+    // constant time, the position of the first wrong byte is not leaked
+    for (i = 0; i < U2F_KEY_HANDLE_MAC_SIZE; i++) {
+        diff |= mac[i] ^ keyHandle[U2F_KEY_HANDLE_MAC + i];
+    }
+    if (diff != 0) {
+        return false;
+    }
+    os_memmove(iv, keyHandle + U2F_KEY_HANDLE_IV, sizeof(iv));
+    cx_aes_init_key(u2fWrapKeys.encryption, sizeof(u2fWrapKeys.encryption),
+                    &key);
+    cx_aes_iv(&key, CX_LAST | CX_DECRYPT | CX_CHAIN_CBC | CX_PAD_NONE, iv,
+              keyHandle + U2F_KEY_HANDLE_KEY, 32, privateKey);
+    os_memset(&key, 0, sizeof(key));
+    return true;
+}
+
+static uint16_t u2f_crypto_sign(uint8_t *rawKey, uint8_t *hash, uint8_t *out) {
+    cx_ecfp_private_key_t privateKey;
+    uint16_t length;
+
+    cx_ecfp_init_private_key(CX_CURVE_256R1, rawKey, 32, &privateKey);
+    length = cx_ecdsa_sign(&privateKey, CX_RND_RFC6979 | CX_LAST, CX_SHA256,
+                           hash, 32, out);
+    os_memset(&privateKey, 0, sizeof(privateKey));
+    return length;
+}
+
+uint16_t u2f_crypto_register(uint8_t *challenge, uint8_t *applicationParameter,
+                             uint8_t *out) {
+    static const uint8_t HASH_ID[] = {U2F_REGISTER_HASH_ID};
+    cx_sha256_t sha;
+    cx_ecfp_public_key_t publicKey;
+    cx_ecfp_private_key_t privateKey;
+    uint8_t hash[32];
+    uint16_t offset;
+
+    // hash id | application parameter | challenge | key handle | public key
+    cx_sha256_init(&sha);
+    cx_hash(&sha.header, 0, (uint8_t *)HASH_ID, sizeof(HASH_ID), NULL);
+    cx_hash(&sha.header, 0, applicationParameter, 32, NULL);
+    cx_hash(&sha.header, 0, challenge, 32, NULL);
+
+    // staged in front of the key handle for its mac, overwritten by the
+    // public key afterwards
+    os_memmove(out + U2F_REGISTER_KEY_HANDLE - U2F_KEY_HANDLE_PREFIX,
+               applicationParameter, 32);
+    out[U2F_REGISTER_KEY_HANDLE - 1] = U2F_KEY_HANDLE_SIZE;
+
+    cx_ecfp_init_private_key(CX_CURVE_256R1, NULL, 0, &privateKey);
+    cx_ecfp_generate_pair(CX_CURVE_256R1, &publicKey, &privateKey, 0);
+    u2f_crypto_wrap(privateKey.d, out + U2F_REGISTER_KEY_HANDLE);
+    os_memset(&privateKey, 0, sizeof(privateKey));
+
+    cx_hash(&sha.header, 0, out + U2F_REGISTER_KEY_HANDLE, U2F_KEY_HANDLE_SIZE,
+            NULL);
+    cx_hash(&sha.header, CX_LAST, publicKey.W, 65, hash);
+
+    out[0] = U2F_REGISTER_RESERVED;
+    os_memmove(out + 1, publicKey.W, 65);
+    offset = U2F_REGISTER_SIGNATURE;
+    offset += u2f_crypto_sign((uint8_t *)U2F_ATTESTATION_KEY, hash,
+                              out + offset);
+    return offset;
+}
+
+uint16_t u2f_crypto_authenticate(uint8_t *privateKey, uint8_t *challenge,
+                                 uint8_t *applicationParameter, uint8_t *out) {
+    cx_sha256_t sha;
+    uint8_t header[5];
+    uint8_t hash[32];
+    uint32_t counter = u2f_crypto_counter() + 1;
+
+    header[0] = U2F_USER_PRESENCE;
+    header[1] = counter >> 24;
+    header[2] = counter >> 16;
+    header[3] = counter >> 8;
+    header[4] = counter;
+    // committed with the reply, before the signature leaves the device
+    nvm_kv_set(U2F_COUNTER_KEY, header + 1, 4);
+
+    // application parameter | user presence | counter | challenge
+    cx_sha256_init(&sha);
+    cx_hash(&sha.header, 0, applicationParameter, 32, NULL);
+    cx_hash(&sha.header, 0, header, sizeof(header), NULL);
+    cx_hash(&sha.header, CX_LAST, challenge, 32, hash);
+
+    os_memmove(out, header, sizeof(header));
+    return sizeof(header) + u2f_crypto_sign(privateKey, hash,
+                                            out + sizeof(header));
+}
+
+uint32_t u2f_crypto_counter(void) {
+    uint8_t value[4];
+    if (nvm_kv_get(U2F_COUNTER_KEY, value, sizeof(value)) != sizeof(value)) {
+        return 0;
+    }
+    return U4BE(value, 0);
+}
+
+#endif // HAVE_U2F_AUTHENTICATOR
+
+#endif
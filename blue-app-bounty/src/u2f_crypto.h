@@ -0,0 +1,112 @@
+/*
+*******************************************************************************
+*   Portable FIDO U2F implementation
+*   (c) 2016 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*   limitations under the License.
+********************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef __U2F_CRYPTO_H__
+
+#define __U2F_CRYPTO_H__
+
+#ifdef HAVE_U2F_AUTHENTICATOR
+
+/**
+ * U2F authenticator keys.
+ * No credential is stored: the P-256 private key generated at registration
+ * is returned to the relying party encrypted in the key handle, and
+ * recovered from it at authentication. The wrapping keys are derived once
+ * per session from the device seed (os_perso_derive_node_bip32) and kept in
+ * RAM.
+ *
+ * Key handle: iv (16) | AES-128-CBC(private key) (32) | mac (16)
+ * mac: HMAC-SHA256 truncated to 16 bytes over application parameter | key
+ * handle length | iv | encrypted private key. The application parameter
+ * and the key handle length are the 33 bytes preceding the key handle in
+ * memory, as laid out in an authentication request: a key handle is only
+ * unwrapped for the application it was issued to.
+ *
+ * The signature counter is persisted in the NVRAM key-value store, before
+ * the signature is replied.
+ *
+ * Bench and development builds only (HAVE_U2F_BENCH and
+ * HAVE_U2F_DEV_ATTESTATION), until the device checks the user presence and
+ * an attestation key is provisioned:
+ * - registrations and enforce-user-presence authentications answer 0x6985,
+ *   dont-enforce-user-presence authentications are signed with the user
+ *   presence flag clear
+ * - the development attestation key is public in the sources, registrations
+ *   are only built by the bench, without the attestation certificate
+ */
+
+#define U2F_KEY_HANDLE_SIZE 64
+
+// reserved byte, public key, key handle length
+#define U2F_REGISTER_KEY_HANDLE (1 + 65 + 1)
+// the attestation certificate is left out, see above
+#define U2F_REGISTER_SIGNATURE (U2F_REGISTER_KEY_HANDLE + U2F_KEY_HANDLE_SIZE)
+// written by u2f_crypto_register, up to the attestation signature
+#define U2F_REGISTER_MAX_SIZE (U2F_REGISTER_SIGNATURE + 72)
+// user presence, counter, signature
+#define U2F_AUTHENTICATE_MAX_SIZE (1 + 4 + 72)
+
+// key of the signature counter in the NVRAM key-value store
+#define U2F_COUNTER_KEY 1
+
+/**
+ * Wrap a private key into keyHandle, preceded by the application parameter
+ * and the key handle length.
+ */
+void u2f_crypto_wrap(uint8_t *privateKey, uint8_t *keyHandle);
+
+/**
+ * Check the mac of keyHandle and recover its private key. Return false when
+ * the key handle was not issued by this device for the application.
+ */
+bool u2f_crypto_unwrap(uint8_t *keyHandle, uint8_t *privateKey);
+
+/**
+ * Registration response without the status word and the attestation
+ * certificate in out: reserved byte | public key | key handle length | key
+ * handle | attestation signature. The inputs are read before out is
+ * written, they may be located in out (U2F message buffer). Return the
+ * length written to out.
+ */
+uint16_t u2f_crypto_register(uint8_t *challenge, uint8_t *applicationParameter,
+                             uint8_t *out);
+
+/**
+ * Authentication response without the status word in out: user presence |
+ * counter | signature. The counter is incremented and persisted first. The
+ * inputs are read before out is written. Return the response length.
+ */
+uint16_t u2f_crypto_authenticate(uint8_t *privateKey, uint8_t *challenge,
+                                 uint8_t *applicationParameter, uint8_t *out);
+
+/**
+ * Current value of the signature counter.
+ */
+uint32_t u2f_crypto_counter(void);
+
+/**
+ * Forget the wrapping keys, derived again at the next use.
+ */
+void u2f_crypto_reset(void);
+
+#endif // HAVE_U2F_AUTHENTICATOR
+
+#endif
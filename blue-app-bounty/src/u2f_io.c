@@ -23,10 +23,16 @@
 #include <string.h>
 #include "os.h"
 
+#include "os_format.h"
 #include "os_io_seproxyhal.h"
 
 #include "u2f_io.h"
 #include "u2f_transport.h"
+#include "usbd_hid_impl.h"
+
+#ifdef HAVE_IO_OVERLAY
+#include "os_io_overlay.h"
+#endif // HAVE_IO_OVERLAY
 
 extern void u2f_reset_display(void);
 
@@ -34,17 +40,77 @@ volatile unsigned char u2fCommandSent = 0;
 volatile unsigned char u2fFirstCommand = 0;
 volatile unsigned char u2fClosed = 0;
 
+#if defined(HAVE_USB_COMPOSITE) && defined(HAVE_IO_USB_TX_QUEUE)
+#define U2F_IO_ASYNC
+// segments posted on the FIDO IN endpoint, used round robin: the next one is
+// free as long as the endpoint queue is not full
+static unsigned char u2fSegments[IO_USB_TX_QUEUE_DEPTH][MAX_SEGMENT_SIZE];
+static unsigned char u2fSegmentNext;
+#define u2fSegment (u2fSegments[u2fSegmentNext])
+// segment of the fragment which completion sends the next one
+static unsigned char *u2fFragmentSegment;
+// a fragment found the queue full, it is sent again on the next completion
+static unsigned char u2fFragmentStalled;
+// single segment reply (init, error, keepalive) which found the queue full,
+// sent on the next completion, before any fragment. A newer one replaces it
+static unsigned char u2fReply[USB_SEGMENT_SIZE];
+static unsigned char u2fReplyLength;
+
+static void u2f_io_sent(unsigned int ep, unsigned char *buffer,
+                        unsigned short length) {
+    UNUSED(ep);
+    UNUSED(length);
+    if (buffer == u2fFragmentSegment) {
+        // the next fragment is due
+        u2fFragmentSegment = NULL;
+        u2fFragmentStalled = 1;
+    }
+    if (u2fReplyLength != 0) {
+        // a segment has just been freed
+        u2f_io_send(u2fReply, u2fReplyLength, U2F_MEDIA_USB);
+        u2fReplyLength = 0;
+    }
+    if (!u2fFragmentStalled) {
+        return;
+    }
+    u2fFragmentStalled = 0;
+    if (u2fService.sending) {
+        // stalls again if the reply took the last segment
+        u2f_continue_sending_fragmented_response((u2f_service_t *)&u2fService);
+    }
+}
+#endif // HAVE_USB_COMPOSITE && HAVE_IO_USB_TX_QUEUE
+
 void u2f_io_open_session(void) {
     // PRINTF("u2f_io_open_session\n");
     u2fCommandSent = 0;
     u2fFirstCommand = 1;
     u2fClosed = 0;
+#ifdef U2F_IO_ASYNC
+    // called for each received packet, a response being sent (channel busy
+    // case) keeps its completion state
+    if (!u2fService.sending) {
+        u2fFragmentSegment = NULL;
+        u2fFragmentStalled = 0;
+    }
+#endif // U2F_IO_ASYNC
 }
 
+// unless the U2F buffers are members of the I/O overlay
+#ifndef u2fSegment
 unsigned char u2fSegment[MAX_SEGMENT_SIZE];
+#endif // u2fSegment
 
-void u2f_io_send(uint8_t *buffer, uint16_t length,
+bool u2f_io_send(uint8_t *buffer, uint16_t length,
                  u2f_transport_media_t media) {
+#ifdef U2F_IO_ASYNC
+    if ((media == U2F_MEDIA_USB) &&
+        (io_usb_tx_pending(U2F_EPIN_ADDR) == IO_USB_TX_QUEUE_DEPTH)) {
+        // the host is not reading, all segments are still in use
+        LOG(F_STR("u2f segment not sent"));
+        return false;
+    }
+#endif // U2F_IO_ASYNC
     if (media == U2F_MEDIA_USB) {
         os_memset(u2fSegment, 0, sizeof(u2fSegment));
     }
@@ -55,7 +121,18 @@ void u2f_io_send(uint8_t *buffer, uint16_t length,
     }
     switch (media) {
     case U2F_MEDIA_USB:
+#if defined(U2F_IO_ASYNC)
+        // FIDO HID interface of the composite device, completion handled on
+        // the event path
+        io_usb_tx_post(U2F_EPIN_ADDR, u2fSegment, USB_SEGMENT_SIZE,
+                       u2f_io_sent);
+        u2fSegmentNext = (u2fSegmentNext + 1) % IO_USB_TX_QUEUE_DEPTH;
+#elif defined(HAVE_USB_COMPOSITE)
+        // FIDO HID interface of the composite device
+        io_usb_send_ep(U2F_EPIN_ADDR, u2fSegment, USB_SEGMENT_SIZE, 20);
+#else  // HAVE_USB_COMPOSITE
         io_usb_send_apdu_data(u2fSegment, USB_SEGMENT_SIZE);
+#endif // HAVE_USB_COMPOSITE
         break;
 #ifdef HAVE_BLE
     case U2F_MEDIA_BLE:
@@ -63,9 +140,42 @@ void u2f_io_send(uint8_t *buffer, uint16_t length,
         break;
 #endif
     default:
-        PRINTF("Request to send on unsupported media %d\n", media);
+        LOG(F_STR("u2f send on unsupported media ") F_U32(media));
         break;
     }
+    return true;
+}
+
+u2f_io_fragment_status_t u2f_io_send_fragment(uint8_t *buffer, uint16_t length,
+                                              u2f_transport_media_t media) {
+#ifdef U2F_IO_ASYNC
+    if (media == U2F_MEDIA_USB) {
+        unsigned char *segment = u2fSegment;
+        // a stalled reply goes first
+        if ((u2fReplyLength != 0) || !u2f_io_send(buffer, length, media)) {
+            // resumed by the completion of any of the posted segments
+            u2fFragmentStalled = 1;
+            return U2F_IO_FRAGMENT_STALLED;
+        }
+        u2fFragmentSegment = segment;
+        return U2F_IO_FRAGMENT_POSTED;
+    }
+#endif // U2F_IO_ASYNC
+    u2f_io_send(buffer, length, media);
+    return U2F_IO_FRAGMENT_SENT;
+}
+
+void u2f_io_send_reply(uint8_t *buffer, uint16_t length,
+                       u2f_transport_media_t media) {
+#ifdef U2F_IO_ASYNC
+    if (!u2f_io_send(buffer, length, media)) {
+        // sent by the completion of any of the posted segments
+        u2fReplyLength = MIN(length, sizeof(u2fReply));
+        os_memmove(u2fReply, buffer, u2fReplyLength);
+    }
+#else  // U2F_IO_ASYNC
+    u2f_io_send(buffer, length, media);
+#endif // U2F_IO_ASYNC
 }
 
 void u2f_io_close_session(void) {
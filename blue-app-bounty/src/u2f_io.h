@@ -28,8 +28,26 @@
 
 #define EXCEPTION_DISCONNECT 0x80
 
+typedef enum {
+    // sent, the next fragment can be sent right away
+    U2F_IO_FRAGMENT_SENT,
+    // posted, the next fragment is sent upon its completion by
+    // u2f_continue_sending_fragmented_response
+    U2F_IO_FRAGMENT_POSTED,
+    // not sent (transmit queue full), it is sent again upon the next
+    // completion by u2f_continue_sending_fragmented_response
+    U2F_IO_FRAGMENT_STALLED,
+} u2f_io_fragment_status_t;
+
 void u2f_io_open_session(void);
-void u2f_io_send(uint8_t *buffer, uint16_t length, u2f_transport_media_t media);
+// returns false when the segment could not be sent (transmit queue full)
+bool u2f_io_send(uint8_t *buffer, uint16_t length, u2f_transport_media_t media);
+// single segment reply, kept and sent on the next completion when the
+// transmit queue is full
+void u2f_io_send_reply(uint8_t *buffer, uint16_t length,
+                       u2f_transport_media_t media);
+u2f_io_fragment_status_t u2f_io_send_fragment(uint8_t *buffer, uint16_t length,
+                                              u2f_transport_media_t media);
 void u2f_io_close_session(void);
 
 #endif
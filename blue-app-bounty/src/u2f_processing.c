@@ -25,6 +25,7 @@
 #include "u2f_service.h"
 #include "u2f_transport.h"
 #include "u2f_processing.h"
+#include "u2f_crypto.h"
 
 void handleApdu(volatile unsigned int *flags, volatile unsigned int *tx);
 void u2f_proxy_response(u2f_service_t *service, unsigned int tx);
@@ -61,6 +62,7 @@ static const uint8_t PROXY_MAGIC[] = {'b', 't', 'y'};
 
 #define P1_SIGN_CHECK_ONLY 0x07
 #define P1_SIGN_SIGN 0x03
+#define P1_SIGN_DONT_ENFORCE 0x08
 
 #define U2F_ENROLL_RESERVED 0x05
 #define SIGN_USER_PRESENCE_MASK 0x01
@@ -81,10 +83,53 @@ void u2f_handle_enroll(u2f_service_t *service, uint8_t p1, uint8_t p2,
                                      sizeof(SW_WRONG_LENGTH), true);
         return;
     }
+#ifdef HAVE_U2F_AUTHENTICATOR
+    // a registration always requires the user presence, which cannot be
+    // checked yet (see u2f_crypto.h)
+    u2f_send_fragmented_response(service, U2F_CMD_MSG,
+                                 (uint8_t *)SW_PROOF_OF_PRESENCE_REQUIRED,
+                                 sizeof(SW_PROOF_OF_PRESENCE_REQUIRED), true);
+#else  // HAVE_U2F_AUTHENTICATOR
     u2f_send_fragmented_response(service, U2F_CMD_MSG, (uint8_t *)SW_INTERNAL,
                                  sizeof(SW_INTERNAL), true);
+#endif // HAVE_U2F_AUTHENTICATOR
 }
 
+#ifdef HAVE_U2F_AUTHENTICATOR
+
+// challenge | application parameter | key handle length | key handle
+static bool u2f_authenticate(u2f_service_t *service, uint8_t p1,
+                             uint8_t *buffer, uint16_t length) {
+    uint8_t privateKey[32];
+    uint16_t offset;
+
+    if ((length != 32 + 32 + 1 + U2F_KEY_HANDLE_SIZE) ||
+        (buffer[64] != U2F_KEY_HANDLE_SIZE) ||
+        !u2f_crypto_unwrap(buffer + 65, privateKey)) {
+        return false;
+    }
+    if (p1 != P1_SIGN_DONT_ENFORCE) {
+        // the key handle is valid, but the user presence cannot be checked
+        // yet (check-only answers the same)
+        os_memset(privateKey, 0, sizeof(privateKey));
+        u2f_send_fragmented_response(service, U2F_CMD_MSG,
+                                     (uint8_t *)SW_PROOF_OF_PRESENCE_REQUIRED,
+                                     sizeof(SW_PROOF_OF_PRESENCE_REQUIRED),
+                                     true);
+        return true;
+    }
+    offset = u2f_crypto_authenticate(privateKey, buffer, buffer + 32,
+                                     service->messageBuffer);
+    os_memset(privateKey, 0, sizeof(privateKey));
+    os_memmove(service->messageBuffer + offset, SW_SUCCESS,
+               sizeof(SW_SUCCESS));
+    u2f_send_fragmented_response(service, U2F_CMD_MSG, service->messageBuffer,
+                                 offset + sizeof(SW_SUCCESS), true);
+    return true;
+}
+
+#endif // HAVE_U2F_AUTHENTICATOR
+
 void u2f_handle_sign(u2f_service_t *service, uint8_t p1, uint8_t p2,
                      uint8_t *buffer, uint16_t length) {
     (void)p1;
@@ -101,12 +146,20 @@ void u2f_handle_sign(u2f_service_t *service, uint8_t p1, uint8_t p2,
                                      sizeof(SW_WRONG_LENGTH), true);
         return;
     }
-    if ((p1 != P1_SIGN_CHECK_ONLY) && (p1 != P1_SIGN_SIGN)) {
+    if ((p1 != P1_SIGN_CHECK_ONLY) && (p1 != P1_SIGN_SIGN) &&
+        (p1 != P1_SIGN_DONT_ENFORCE)) {
         u2f_response_error(service, ERROR_PROP_INVALID_PARAMETERS_APDU, true,
                            service->channel);
         return;
     }
 
+#ifdef HAVE_U2F_AUTHENTICATOR
+    // key handles of this device, else an APDU for the proxy
+    if (u2f_authenticate(service, p1, buffer, length)) {
+        return;
+    }
+#endif // HAVE_U2F_AUTHENTICATOR
+
     keyHandleLength = buffer[64];
     for (i = 0; i < keyHandleLength; i++) {
         buffer[65 + i] ^= PROXY_MAGIC[i % sizeof(PROXY_MAGIC)];
@@ -116,7 +169,18 @@ void u2f_handle_sign(u2f_service_t *service, uint8_t p1, uint8_t p2,
         u2f_send_fragmented_response(service, U2F_CMD_MSG,
                                      (uint8_t *)SW_BAD_KEY_HANDLE,
                                      sizeof(SW_BAD_KEY_HANDLE), true);
+        return;
+    }
+#ifdef HAVE_USB_COMPOSITE
+    // G_io_apdu_buffer is shared with the Ledger HID interface, which may be
+    // exchanging a command concurrently
+    if ((G_io_apdu_media != IO_APDU_MEDIA_NONE) ||
+        (G_io_usb_hid_sequence_number != 0)) {
+        u2f_response_error(service, ERROR_CHANNEL_BUSY, true,
+                           service->channel);
+        return;
     }
+#endif // HAVE_USB_COMPOSITE
     // Check that it looks like an APDU
     os_memmove(G_io_apdu_buffer, buffer + 65, keyHandleLength);
     handleApdu(&flags, &tx);
@@ -141,6 +205,32 @@ void u2f_handle_get_version(u2f_service_t *service, uint8_t p1, uint8_t p2,
                                  sizeof(VERSION), true);
 }
 
+#ifdef HAVE_U2F_AUTHENTICATOR
+
+void u2f_handle_get_counter(u2f_service_t *service, uint8_t p1, uint8_t p2,
+                            uint8_t *buffer, uint16_t length) {
+    uint32_t counter;
+    (void)p1;
+    (void)p2;
+    (void)buffer;
+    if (length != 0) {
+        u2f_send_fragmented_response(service, U2F_CMD_MSG,
+                                     (uint8_t *)SW_WRONG_LENGTH,
+                                     sizeof(SW_WRONG_LENGTH), true);
+        return;
+    }
+    counter = u2f_crypto_counter();
+    service->messageBuffer[0] = counter >> 24;
+    service->messageBuffer[1] = counter >> 16;
+    service->messageBuffer[2] = counter >> 8;
+    service->messageBuffer[3] = counter;
+    os_memmove(service->messageBuffer + 4, SW_SUCCESS, sizeof(SW_SUCCESS));
+    u2f_send_fragmented_response(service, U2F_CMD_MSG, service->messageBuffer,
+                                 4 + sizeof(SW_SUCCESS), true);
+}
+
+#endif // HAVE_U2F_AUTHENTICATOR
+
 void u2f_handle_cmd_init(u2f_service_t *service, uint8_t *buffer,
                          uint16_t length, uint8_t *channelInit) {
     // screen_printf("U2F init\n");
@@ -216,6 +306,11 @@ void u2f_handle_cmd_msg(u2f_service_t *service, uint8_t *buffer,
         // screen_printf("version\n");
         u2f_handle_get_version(service, p1, p2, buffer + 7, dataLength);
         break;
+#ifdef HAVE_U2F_AUTHENTICATOR
+    case FIDO_INS_PROP_GET_COUNTER:
+        u2f_handle_get_counter(service, p1, p2, buffer + 7, dataLength);
+        break;
+#endif // HAVE_U2F_AUTHENTICATOR
     default:
         // screen_printf("unsupported\n");
         u2f_send_fragmented_response(service, U2F_CMD_MSG,
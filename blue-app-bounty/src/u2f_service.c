@@ -23,7 +23,10 @@
 #include "u2f_service.h"
 #include "u2f_transport.h"
 #include "u2f_processing.h"
+#include "u2f_io.h"
 #include "u2f_timer.h"
+#include "os_nvm_cache.h"
+#include "os_format.h"
 
 // not too fast blinking
 #define DEFAULT_TIMER_INTERVAL_MS 500
@@ -69,20 +72,23 @@ void u2f_send_direct_response_short(u2f_service_t *service, uint8_t *buffer,
         break;
 #endif
     default:
-        PRINTF("Request to send on unsupported media %d\n",
-               service->packetMedia);
+        LOG(F_STR("u2f send on unsupported media ") F_U32(service->packetMedia));
         break;
     }
     if (len > maxSize) {
         return;
     }
-    u2f_io_send(buffer, len, service->packetMedia);
+    u2f_io_send_reply(buffer, len, service->packetMedia);
     u2f_io_close_session();
 }
 
 void u2f_send_fragmented_response(u2f_service_t *service, uint8_t cmd,
                                   uint8_t *buffer, uint16_t len,
                                   bool resetAfterSend) {
+#ifdef HAVE_NVM_CACHE
+    // the NVRAM writes of the message are persisted before it is replied
+    nvm_cache_commit();
+#endif // HAVE_NVM_CACHE
     if (resetAfterSend) {
         service->transportState = U2F_SENDING_RESPONSE;
     }
@@ -129,9 +135,19 @@ void u2f_continue_sending_fragmented_response(u2f_service_t *service) {
             os_memmove(service->outputBuffer + headerSize,
                        service->sendBuffer + service->sendOffset, blockSize);
         }
-        u2f_io_send(service->outputBuffer, dataSize, service->packetMedia);
+        u2f_io_fragment_status_t status = u2f_io_send_fragment(
+            service->outputBuffer, dataSize, service->packetMedia);
+        if (status == U2F_IO_FRAGMENT_STALLED) {
+            // the same fragment is built again on the next completion
+            return;
+        }
         service->sendOffset += blockSize;
         service->sendPacketIndex++;
+        if ((status == U2F_IO_FRAGMENT_POSTED) &&
+            (service->sendOffset != service->sendLength)) {
+            // continued on the fragment completion
+            return;
+        }
     } while (service->sendOffset != service->sendLength);
     if (service->sendOffset == service->sendLength) {
         u2f_io_close_session();
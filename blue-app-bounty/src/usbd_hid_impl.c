@@ -57,11 +57,30 @@
 #include "usbd_conf.h"
 
 #include "usbd_def.h"
+#include "usbd_hid_impl.h"
 #include "os_io_seproxyhal.h"
 
 #include "u2f_service.h"
 #include "u2f_transport.h"
 
+#ifdef HAVE_IO_OVERLAY
+#include "os_io_overlay.h"
+#endif // HAVE_IO_OVERLAY
+
+#ifdef HAVE_USB_COMPOSITE
+#ifndef HAVE_U2F
+#error HAVE_USB_COMPOSITE requires HAVE_U2F
+#endif // HAVE_U2F
+#ifndef HAVE_USB_CLASS_CCID
+#error HAVE_USB_COMPOSITE requires HAVE_USB_CLASS_CCID
+#endif // HAVE_USB_CLASS_CCID
+#ifndef HAVE_USB_REGISTRY
+#error HAVE_USB_COMPOSITE requires HAVE_USB_REGISTRY
+#endif // HAVE_USB_REGISTRY
+#include "usbd_ccid_core.h"
+#include "usbd_registry.h"
+#endif // HAVE_USB_COMPOSITE
+
 /** @togroup STM32_USB_DEVICE_LIBRARY
   * @{
   */
@@ -262,6 +281,13 @@ the configuration*/
                             /* 41 */
 };
 
+#ifdef HAVE_USB_COMPOSITE
+/* USB composite device Configuration Descriptor, generated from the
+ * interfaces of usbd_registry_app.h */
+__ALIGN_BEGIN const uint8_t USBD_Registry_CfgDesc[] __ALIGN_END =
+    USBD_REGISTRY_CFGDESC(0xC0 /* bus powered */, 0x32 /* 100 mA */);
+#endif // HAVE_USB_COMPOSITE
+
 /* USB HID device Configuration Descriptor */
 __ALIGN_BEGIN const uint8_t const USBD_HID_Desc[] __ALIGN_END = {
     /* 18 */
@@ -427,11 +453,18 @@ uint8_t *USBD_HID_GetCfgDesc_impl(uint16_t *length) {
 }
 
 uint8_t *USBD_HID_GetHidDescriptor_impl(uint16_t *len) {
+    // same report length on both HID interfaces of the composite device
     *len = sizeof(USBD_HID_Desc);
     return (uint8_t *)USBD_HID_Desc;
 }
 
 uint8_t *USBD_HID_GetReportDescriptor_impl(uint16_t *len) {
+#ifdef HAVE_USB_COMPOSITE
+    if ((USBD_Device.request.wIndex & 0xFF) == USBD_ITF_U2F) {
+        *len = sizeof(HID_ReportDesc);
+        return (uint8_t *)HID_ReportDesc;
+    }
+#endif // HAVE_USB_COMPOSITE
     *len = sizeof(HID_DynReportDesc);
     return (uint8_t *)HID_DynReportDesc;
 }
@@ -452,6 +485,22 @@ uint8_t *USBD_HID_GetReportDescriptor_impl(uint16_t *len) {
   */
 extern volatile unsigned short G_io_apdu_length;
 
+// Ledger HID framing of APDUs
+static void USBD_HID_DataOut_apdu(uint8_t *buffer) {
+    // add to the hid transport
+    switch (io_usb_hid_receive(io_usb_send_apdu_data, buffer,
+                               io_seproxyhal_get_ep_rx_size(HID_EPOUT_ADDR))) {
+    default:
+        break;
+
+    case IO_USB_APDU_RECEIVED:
+        G_io_apdu_media = IO_APDU_MEDIA_USB_HID; // for application code
+        G_io_apdu_state = APDU_USB_HID; // for next call to io_exchange
+        G_io_apdu_length = G_io_usb_hid_total_length;
+        break;
+    }
+}
+
 uint8_t USBD_HID_DataOut_impl(USBD_HandleTypeDef *pdev, uint8_t epnum,
                               uint8_t *buffer) {
     UNUSED(epnum);
@@ -461,29 +510,68 @@ uint8_t USBD_HID_DataOut_impl(USBD_HandleTypeDef *pdev, uint8_t epnum,
 
     if (fidoActivated) {
 #ifdef HAVE_U2F
-        u2f_transport_handle(&u2fService, buffer,
+        u2f_transport_handle((u2f_service_t *)&u2fService, buffer,
                              io_seproxyhal_get_ep_rx_size(HID_EPOUT_ADDR),
                              U2F_MEDIA_USB);
 #endif
     } else {
-        // add to the hid transport
-        switch (
-            io_usb_hid_receive(io_usb_send_apdu_data, buffer,
-                               io_seproxyhal_get_ep_rx_size(HID_EPOUT_ADDR))) {
-        default:
-            break;
-
-        case IO_USB_APDU_RECEIVED:
-            G_io_apdu_media = IO_APDU_MEDIA_USB_HID; // for application code
-            G_io_apdu_state = APDU_USB_HID; // for next call to io_exchange
-            G_io_apdu_length = G_io_usb_hid_total_length;
-            break;
-        }
+        USBD_HID_DataOut_apdu(buffer);
     }
 
     return USBD_OK;
 }
 
+#ifdef HAVE_USB_COMPOSITE
+
+/**
+  * Composite device interfaces transports, dispatched by USBD_Registry.
+  */
+
+static uint8_t USBD_HID_APDU_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum,
+                                     uint8_t *buffer) {
+    UNUSED(epnum);
+    // prepare receiving the next chunk (masked time)
+    USBD_LL_PrepareReceive(pdev, HID_EPOUT_ADDR, HID_EPOUT_SIZE);
+    USBD_HID_DataOut_apdu(buffer);
+    return USBD_OK;
+}
+
+static uint8_t USBD_HID_U2F_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum,
+                                    uint8_t *buffer) {
+    UNUSED(epnum);
+    USBD_LL_PrepareReceive(pdev, U2F_EPOUT_ADDR, U2F_EPOUT_SIZE);
+    u2f_transport_handle((u2f_service_t *)&u2fService, buffer,
+                         io_seproxyhal_get_ep_rx_size(U2F_EPOUT_ADDR),
+                         U2F_MEDIA_USB);
+    return USBD_OK;
+}
+
+// endpoints opened by the registry, report descriptors are selected by
+// USBD_HID_GetReportDescriptor_impl
+const usbd_interface_ops_t USBD_HID_APDU_Ops = {
+    NULL, NULL, USBD_HID_Setup, NULL, USBD_HID_APDU_DataOut,
+};
+
+const usbd_interface_ops_t USBD_HID_U2F_Ops = {
+    NULL, NULL, USBD_HID_Setup, NULL, USBD_HID_U2F_DataOut,
+};
+
+// the ST class opens its endpoints
+const usbd_interface_ops_t USBD_CCID_Ops = {
+    USBD_CCID_Init,  USBD_CCID_DeInit,  USBD_CCID_Setup,
+    USBD_CCID_DataIn, USBD_CCID_DataOut,
+};
+
+uint8_t SC_AnswerToReset(uint8_t voltage, uint8_t *atr_buffer) {
+    UNUSED(voltage);
+    // return the atr length
+    atr_buffer[0] = 0x3B;
+    atr_buffer[1] = 0;
+    return 2;
+}
+
+#endif // HAVE_USB_COMPOSITE
+
 /** @defgroup USBD_HID_Private_Functions
   * @{
   */
@@ -496,6 +584,7 @@ static const USBD_DescriptorsTypeDef const HID_Desc = {
     USBD_HID_InterfaceStrDescriptor,    NULL,
 };
 
+#ifndef HAVE_USB_COMPOSITE
 static const USBD_ClassTypeDef const USBD_HID = {
     USBD_HID_Init,
     USBD_HID_DeInit,
@@ -513,13 +602,33 @@ static const USBD_ClassTypeDef const USBD_HID = {
     USBD_HID_GetCfgDesc_impl,
     USBD_HID_GetDeviceQualifierDesc_impl,
 };
+#endif // HAVE_USB_COMPOSITE
 
 void USB_power_U2F(unsigned char enabled, unsigned char fido) {
+#ifdef HAVE_USB_COMPOSITE
+    // the Ledger HID interface reports use the generic page, the FIDO
+    // interface ones HID_ReportDesc (FIDO page), both are always exposed.
+    // fidoActivated only routes the reports of the single HID interface
+    uint16_t page = PAGE_GENERIC;
+    UNUSED(fido);
+#else  // HAVE_USB_COMPOSITE
     uint16_t page = (fido ? PAGE_FIDO : PAGE_GENERIC);
+    fidoActivated = (fido ? true : false);
+#endif // HAVE_USB_COMPOSITE
     os_memmove(HID_DynReportDesc, HID_ReportDesc, sizeof(HID_ReportDesc));
     HID_DynReportDesc[1] = (page & 0xff);
     HID_DynReportDesc[2] = ((page >> 8) & 0xff);
-    fidoActivated = (fido ? true : false);
+
+#ifdef HAVE_IO_OVERLAY
+    // reports are routed to a single transport, which owns the overlay, the
+    // U2F buffers are out of the overlay on the composite device
+    io_overlay_leave(IO_PHASE_USB_HID | IO_PHASE_U2F);
+#ifdef HAVE_USB_COMPOSITE
+    io_overlay_enter(IO_PHASE_USB_HID);
+#else  // HAVE_USB_COMPOSITE
+    io_overlay_enter(fido ? IO_PHASE_U2F : IO_PHASE_USB_HID);
+#endif // HAVE_USB_COMPOSITE
+#endif // HAVE_IO_OVERLAY
 
     os_memset(&USBD_Device, 0, sizeof(USBD_Device));
 
@@ -528,8 +637,31 @@ void USB_power_U2F(unsigned char enabled, unsigned char fido) {
         /* Init Device Library */
         USBD_Init(&USBD_Device, (USBD_DescriptorsTypeDef *)&HID_Desc, 0);
 
+#ifdef HAVE_USB_COMPOSITE
+        /* Register the interfaces of usbd_registry_app.h */
+        USBD_RegisterClass(&USBD_Device,
+                           (USBD_ClassTypeDef *)&USBD_Registry);
+#else  // HAVE_USB_COMPOSITE
         /* Register the HID class */
         USBD_RegisterClass(&USBD_Device, (USBD_ClassTypeDef *)&USBD_HID);
+#endif // HAVE_USB_COMPOSITE
+
+#ifdef HAVE_USB_DESC_CACHE
+        // descriptors are fixed until the next power cycle, enumeration
+        // requests are served without the descriptor callbacks
+        USBD_DescCacheInit(&USBD_Device);
+        USBD_DescCacheAdd(USBD_DESC_CACHE_KEY(HID_REPORT_DESC, 0),
+                          HID_DynReportDesc, sizeof(HID_DynReportDesc));
+        USBD_DescCacheAdd(USBD_DESC_CACHE_KEY(HID_DESCRIPTOR_TYPE, 0),
+                          (uint8_t *)USBD_HID_Desc, sizeof(USBD_HID_Desc));
+#ifdef HAVE_USB_COMPOSITE
+        USBD_DescCacheAdd(USBD_DESC_CACHE_KEY(HID_REPORT_DESC, USBD_ITF_U2F),
+                          (uint8_t *)HID_ReportDesc, sizeof(HID_ReportDesc));
+        USBD_DescCacheAdd(
+            USBD_DESC_CACHE_KEY(HID_DESCRIPTOR_TYPE, USBD_ITF_U2F),
+            (uint8_t *)USBD_HID_Desc, sizeof(USBD_HID_Desc));
+#endif // HAVE_USB_COMPOSITE
+#endif // HAVE_USB_DESC_CACHE
 
         /* Start Device Process */
         USBD_Start(&USBD_Device);
@@ -7,4 +7,28 @@
 #define HID_EPOUT_ADDR 0x02
 #define HID_EPOUT_SIZE 0x40
 
+#ifdef HAVE_USB_COMPOSITE
+
+// composite device interfaces, the Ledger HID one first, as expected by the
+// clients looking for interface 0
+#define USBD_ITF_HID 0
+#define USBD_ITF_U2F 1
+#define USBD_ITF_CCID 2
+#define USBD_ITF_COUNT 3
+
+// FIDO HID interface
+#define U2F_EPIN_ADDR 0x81
+#define U2F_EPIN_SIZE 0x40
+
+#define U2F_EPOUT_ADDR 0x01
+#define U2F_EPOUT_SIZE 0x40
+
+#else // HAVE_USB_COMPOSITE
+
+// U2F reports share the single HID interface
+#define U2F_EPIN_ADDR HID_EPIN_ADDR
+#define U2F_EPOUT_ADDR HID_EPOUT_ADDR
+
+#endif // HAVE_USB_COMPOSITE
+
 #endif // USBD_HID_IMPL_H
@@ -0,0 +1,78 @@
+/*******************************************************************************
+*   Simple bountry
+*   (c) 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#ifndef USBD_REGISTRY_APP_H
+#define USBD_REGISTRY_APP_H
+
+/**
+ * Interfaces of the composite device, see usbd_registry.h. Only macros, this
+ * header is included by usbd_conf.h to size the USB tables.
+ */
+
+#include "usbd_hid_impl.h"
+#include "usbd_ccid_impl.h"
+
+#define USBD_HID_APDU_ENDPOINTS(E, itf)                                        \
+    E(itf, HID_EPIN_ADDR, USBD_EP_TYPE_INTR, HID_EPIN_SIZE, 0x01)              \
+    E(itf, HID_EPOUT_ADDR, USBD_EP_TYPE_INTR, HID_EPOUT_SIZE, 0x01)
+
+#define USBD_HID_U2F_ENDPOINTS(E, itf)                                         \
+    E(itf, U2F_EPIN_ADDR, USBD_EP_TYPE_INTR, U2F_EPIN_SIZE, 0x01)              \
+    E(itf, U2F_EPOUT_ADDR, USBD_EP_TYPE_INTR, U2F_EPOUT_SIZE, 0x01)
+
+#define USBD_CCID_ENDPOINTS(E, itf)                                            \
+    E(itf, CCID_BULK_IN_EP, USBD_EP_TYPE_BULK, CCID_BULK_EPIN_SIZE, 0x00)      \
+    E(itf, CCID_BULK_OUT_EP, USBD_EP_TYPE_BULK, CCID_BULK_EPOUT_SIZE, 0x00)    \
+    E(itf, CCID_INTR_IN_EP, USBD_EP_TYPE_INTR, CCID_INTR_EPIN_SIZE, 0x18)
+
+// CCID class descriptor, T=0 short APDU exchanges
+#define USBD_CCID_CLASS_DESC                                                   \
+    , 0x36,                 /* bLength: CCID Descriptor size */                \
+        0x21,               /* bDescriptorType: Functional Descriptor type */  \
+        0x10, 0x01,         /* bcdCCID: CCID Class Spec release (1.10) */      \
+        0x00,               /* bMaxSlotIndex */                                \
+        0x03,               /* bVoltageSupport: 5.0V, 3.0V */                  \
+        0x01, 0x00, 0x00, 0x00, /* dwProtocols: T=0 */                         \
+        0x10, 0x0E, 0x00, 0x00, /* dwDefaultClock: 3.6Mhz */                   \
+        0x10, 0x0E, 0x00, 0x00, /* dwMaximumClock */                           \
+        0x00,                   /* bNumClockSupported */                       \
+        0xCD, 0x25, 0x00, 0x00, /* dwDataRate: 9677 bps */                     \
+        0xCD, 0x25, 0x00, 0x00, /* dwMaxDataRate */                            \
+        0x00,                   /* bNumDataRatesSupported */                   \
+        0x00, 0x00, 0x00, 0x00, /* dwMaxIFSD: 0 (T=0 only) */                  \
+        0x00, 0x00, 0x00, 0x00, /* dwSynchProtocols */                         \
+        0x00, 0x00, 0x00, 0x00, /* dwMechanical */                             \
+        0x38, 0x00, EXCHANGE_LEVEL_FEATURE, 0x00, /* dwFeatures */             \
+        0x0F, 0x01, 0x00, 0x00, /* dwMaxCCIDMessageLength: 261 + 10 */         \
+        0x00,                   /* bClassGetResponse */                        \
+        0x00,                   /* bClassEnvelope */                           \
+        0x00, 0x00,             /* wLcdLayout: no LCD */                       \
+        0x00,                   /* bPINSupport */                              \
+        0x01                    /* bMaxCCIDBusySlots */
+
+// X(number, class, subclass, protocol, class_desc, endpoints, ops)
+#define USBD_REGISTRY_APP_INTERFACES(X)                                        \
+    X(USBD_ITF_HID, 0x03, 0x00, 0x00,                                          \
+      USBD_REGISTRY_HID_DESC(sizeof(HID_DynReportDesc)),                       \
+      USBD_HID_APDU_ENDPOINTS, USBD_HID_APDU_Ops)                              \
+    X(USBD_ITF_U2F, 0x03, 0x00, 0x00,                                          \
+      USBD_REGISTRY_HID_DESC(sizeof(HID_ReportDesc)), USBD_HID_U2F_ENDPOINTS,  \
+      USBD_HID_U2F_Ops)                                                        \
+    X(USBD_ITF_CCID, 0x0B, 0x00, 0x00, USBD_CCID_CLASS_DESC,                   \
+      USBD_CCID_ENDPOINTS, USBD_CCID_Ops)
+
+#endif // USBD_REGISTRY_APP_H
@@ -24,6 +24,11 @@ import os
 import math
 import collections
 import traceback
+import hashlib
+try:
+	from StringIO import StringIO
+except ImportError:
+	from io import StringIO
 
 widthmax = 4096
 heightmax = 4096
@@ -31,100 +36,38 @@ forcedBPP = None
 hexbitmaponly = False
 glyphcfile = False
 glyphcheader = False
-
-try:
-
-	# 2: python imagefile
-	if (len(sys.argv) == 2):
-		filename = sys.argv[1];
-		if not os.path.exists(filename):
-			sys.sterr.write(sys.argv[0] + ": [<Wmax> <Hmax>] <imagefile> [<forcedBPP>] [hexbitmaponly|glyphcfile|glyphcheader]\n")
-			sys.sterr.write("Error: " + sys.argv[1] + " does not exists !\n")
-			sys.exit(2)
-	# 3: python imagefile forcedBPP
-	# 3: python imagefile hexbitmaponly
-	elif (len(sys.argv) == 3):
-		filename = sys.argv[1];
-		if not os.path.exists(filename):
-			sys.sterr.write(sys.argv[0] + ": [<Wmax> <Hmax>] <imagefile> [<forcedBPP>] [hexbitmaponly|glyphcfile|glyphcheader]\n")
-			sys.sterr.write("Error: " + filename + " does not exists !\n")
-			sys.exit(2)
-		if (sys.argv[2] == "hexbitmaponly"):
-			hexbitmaponly = True
-		elif (sys.argv[2] == "glyphcfile"):
-			glyphcfile = True
-		elif (sys.argv[2] == "glyphcheader"):
-			glyphcheader = True
-		else:
-			forcedBPP = int(sys.argv[2])
-	# 4: python max max imagefile
-	# 4: python imagefile forcedBPP hexbitmaponly
-	elif (len(sys.argv) == 4):
-		filename = sys.argv[1];
-		if not os.path.exists(filename):
-			filename = sys.argv[3];
-			if not os.path.exists(filename):
-				sys.sterr.write(sys.argv[0] + ": [<Wmax> <Hmax>] <imagefile> [<forcedBPP>] [hexbitmaponly|glyphcfile|glyphcheader]\n")
-				sys.sterr.write("Error: " + filename + " does not exists !\n")
-				sys.exit(2)
-			widthmax = int(sys.argv[1])
-			heightmax = int(sys.argv[2])		
-		else:
-			forcedBPP = int(sys.argv[2])
-			if (sys.argv[3] == "hexbitmaponly"):
-				hexbitmaponly = True
-			elif (sys.argv[2] == "glyphcfile"):
-				glyphcfile = True
-			elif (sys.argv[2] == "glyphcheader"):
-				glyphcheader = True
-			else:
-				sys.sterr.write(sys.argv[0] + ": [<Wmax> <Hmax>] <imagefile> [<forcedBPP>] [hexbitmaponly|glyphcfile|glyphcheader]\n")
-				sys.exit(2)
-	# 5: python max max imagefile forcedBPP
-	# 5: python max max imagefile hexbitmaponly
-	elif (len(sys.argv) == 5):
-		filename = sys.argv[3];
-		if not os.path.exists(filename):
-			sys.sterr.write(sys.argv[0] + ": [<Wmax> <Hmax>] <imagefile> [<forcedBPP>] [hexbitmaponly|glyphcfile|glyphcheader]\n")
-			sys.sterr.write("Error: " + filename + " does not exists !\n")
-			sys.exit(2)
-		widthmax = int(sys.argv[1])
-		heightmax = int(sys.argv[2])		
-
-		if (sys.argv[4] == "hexbitmaponly"):
-			hexbitmaponly = True
-		elif (sys.argv[2] == "glyphcfile"):
-			glyphcfile = True
-		elif (sys.argv[2] == "glyphcheader"):
-			glyphcheader = True
-		else:
-			forcedBPP = int(sys.argv[4])
-
-	# 6: python max max imagefile forcedBPP hexbitmaponly
-	elif (len(sys.argv) == 6):
-		filename = sys.argv[3]
-		if not os.path.exists(filename):
-			sys.sterr.write(sys.argv[0] + ": [<Wmax> <Hmax>] <imagefile> [<forcedBPP>] [hexbitmaponly|glyphcfile|glyphcheader]\n")
-			sys.sterr.write("Error: " + filename + " does not exists !\n")
-			sys.exit(2)
-		widthmax = int(sys.argv[1])
-		heightmax = int(sys.argv[2])		
-		forcedBPP = int(sys.argv[4])
-		if (sys.argv[5] == "hexbitmaponly"):
-			hexbitmaponly = True
-		elif (sys.argv[2] == "glyphcfile"):
-			glyphcfile = True
-		elif (sys.argv[2] == "glyphcheader"):
-			glyphcheader = True
-		else:
-			sys.sterr.write(sys.argv[0] + ": [<Wmax> <Hmax>] <imagefile> [<forcedBPP>] [hexbitmaponly|glyphcfile|glyphcheader]\n")
-			sys.sterr.write("Error: " + filename + " does not exists !\n")
-			sys.exit(2)
-	else:
-		sys.sterr.write(sys.argv[0] + ": [<Wmax> <Hmax>] <imagefile> [<forcedBPP>] [hexbitmaponly|glyphcfile|glyphcheader]\n")
-		sys.sterr.write("Error: " + sys.argv[1] + " does not exists !\n")
-		sys.exit(2)
-
+# packbits compression of the bitmap, when smaller (BAGL_ICON_FORMAT_RLE)
+rle = False
+# only print the bitmap size, raw and compressed
+sizereport = False
+
+# packbits: <n> (0..127) followed by n+1 literal bytes, or <n> (129..255)
+# followed by a byte repeated 257-n times
+def packbits(data):
+	out = []
+	i = 0
+	while i < len(data):
+		run = 1
+		while i+run < len(data) and run < 128 and data[i+run] == data[i]:
+			run += 1
+		if run >= 3:
+			out += [257-run, data[i]]
+			i += run
+			continue
+		# literal bytes up to the next run of 3 bytes
+		start = i
+		while i < len(data) and i-start < 128:
+			if i+2 < len(data) and data[i] == data[i+1] and data[i] == data[i+2]:
+				break
+			i += 1
+		out += [i-start-1] + data[start:i]
+	return out
+
+def glyph(filename, widthmax, heightmax, forcedBPP, hexbitmaponly, glyphcfile, glyphcheader):
+	# the generated code is discarded, only the sizes are output
+	if sizereport:
+		report_stdout = sys.stdout
+		sys.stdout = open(os.devnull, "w")
 
 	im = Image.open(filename);
 	im.load()
@@ -257,61 +200,75 @@ unsigned char const C_""" + bname + """_bitmap[]""");
 	current_byte = 0
 	current_bit = 0
 	byte_count = 0
+	bitmap = []
 
 	#packed, row preferred
+	for row in range(height):
+		# row first
+		for col in range(width):
+			# return an index in the indexed colors list for indexed address spaces
+			# left to right
+			#perform implicit rotation here (0,0 is left top in bagl, and generally left bottom for various canvas)
+			color_index = im.getpixel((col,row))
+
+			#remap index by luminance
+			color_index = palette_remapping[color_index]
+
+			# le encoded
+			if (forcedBPP) and False:
+				current_byte += ((color_index)<<current_bit)<<(forcedBPP-bits_per_pixel)
+				current_bit+=forcedBPP
+			else:
+				current_byte += (color_index<<current_bit)
+				current_bit+=bits_per_pixel
+
+			if current_bit >= 8:
+				bitmap.append(current_byte)
+				current_bit = 0
+				current_byte = 0
+			
+	# last byte if any
+	if (current_bit > 0):
+		bitmap.append(current_byte)
+
+	# the MCU is always sent the raw bitmap (hexbitmaponly)
+	icon_format = "BAGL_ICON_FORMAT_RAW"
+	if rle and not hexbitmaponly:
+		compressed = packbits(bitmap)
+		if len(compressed) < len(bitmap):
+			icon_format = "BAGL_ICON_FORMAT_RLE"
+			encoded = compressed
+		else:
+			encoded = bitmap
+	else:
+		encoded = bitmap
+
 	if not glyphcheader:
-		for row in range(height):
-			# row first
-			for col in range(width):
-				# return an index in the indexed colors list for indexed address spaces
-				# left to right
-				#perform implicit rotation here (0,0 is left top in bagl, and generally left bottom for various canvas)
-				color_index = im.getpixel((col,row))
-
-				#remap index by luminance
-				color_index = palette_remapping[color_index]
-
-				# le encoded
-				if (forcedBPP) and False:
-					current_byte += ((color_index)<<current_bit)<<(forcedBPP-bits_per_pixel)
-					current_bit+=forcedBPP
-				else:
-					current_byte += (color_index<<current_bit)
-					current_bit+=bits_per_pixel
-
-				if current_bit >= 8:
-					if not hexbitmaponly:
-						sys.stdout.write("0x" + hexbyte(current_byte) + ", ")
-						byte_count+=1
-						if (byte_count >= 16):
-							byte_count = 0;
-							sys.stdout.write("\n  ")
-					else:
-						sys.stdout.write(hexbyte(current_byte))
-					current_bit = 0
-					current_byte = 0
-				
-		# print last byte if any
-		if (current_bit > 0):
+		for b in encoded:
 			if not hexbitmaponly:
-				sys.stdout.write("0x" + hexbyte(current_byte) + ", ")
+				sys.stdout.write("0x" + hexbyte(b) + ", ")
 				byte_count+=1
 				if (byte_count >= 16):
 					byte_count = 0;
 					sys.stdout.write("\n  ")
 			else:
-				sys.stdout.write(hexbyte(current_byte))
+				sys.stdout.write(hexbyte(b))
 
 		if not hexbitmaponly:
 			sys.stdout.write("""};
 
 """)
 
+	# C initializer of the icon format, when the format field exists
+	format_field = ""
+	if rle:
+		format_field = ", " + icon_format
+
 	if not hexbitmaponly:
 		if not glyphcfile and not glyphcheader:
 			# origin 0,0 is left top for blue, instead of left bottom for all image encodings
 			sys.stdout.write("""
-			  { """+str(width)+""", """+str(height)+""", """+str(int(math.log(maxcolor+1, 2)))+""", C_"""+bname+"""_colors, C_"""+bname+"""_bitmap },
+			  { """+str(width)+""", """+str(height)+""", """+str(int(math.log(maxcolor+1, 2)))+""", C_"""+bname+"""_colors, C_"""+bname+"""_bitmap"""+format_field+""" },
 """)
 		else:
 			sys.stdout.write("""#ifdef OS_IO_SEPROXYHAL
@@ -328,10 +285,164 @@ unsigned char const C_""" + bname + """_bitmap[]""");
 				sys.stdout.write("""#endif // GLYPH_""" + bname + """_BPP
 """)
 			else:
-				sys.stdout.write(" = { GLYPH_" + bname + "_WIDTH, GLYPH_" + bname + "_HEIGHT, " + str(bits_per_pixel) + ", C_" + bname + "_colors, C_" + bname + """_bitmap };
+				sys.stdout.write(" = { GLYPH_" + bname + "_WIDTH, GLYPH_" + bname + "_HEIGHT, " + str(bits_per_pixel) + ", C_" + bname + "_colors, C_" + bname + "_bitmap" + format_field + """ };
 """);
 			sys.stdout.write("""#endif // OS_IO_SEPROXYHAL
 """)
+
+	if sizereport:
+		# <name> <raw bitmap bytes> <packbits bytes> <colors bytes>
+		sys.stdout = report_stdout
+		sys.stdout.write(bname + " " + str(len(bitmap)) + " " + str(len(packbits(bitmap))) + " " + str((maxcolor+1)*4) + "\n")
+
+
+# generated code of a glyph, for the given output mode
+def capture(filename, glyphcfile, glyphcheader):
+	stdout = sys.stdout
+	sys.stdout = StringIO()
+	try:
+		glyph(filename, 4096, 4096, None, False, glyphcfile, glyphcheader)
+		return sys.stdout.getvalue()
+	finally:
+		sys.stdout = stdout
+
+
+def write_if_changed(filename, content):
+	if os.path.exists(filename) and open(filename).read() == content:
+		return
+	with open(filename, "w") as f:
+		f.write(content)
+
+
+# per glyph header and source, to be compiled separately. The source starts
+# with a hash of the generator, its options and the image, a glyph is not
+# generated again when unchanged. Files are only written when their content
+# changes, to avoid recompiling.
+def glyphfragments(outdir, filenames):
+	generator = open(os.path.realpath(__file__), "rb").read()
+	if rle:
+		generator += b" rle"
+	for filename in filenames:
+		bname = os.path.splitext(os.path.basename(filename))[0]
+		hfile = os.path.join(outdir, "glyph_" + bname + ".h")
+		cfile = os.path.join(outdir, "glyph_" + bname + ".c")
+		key = "/* glyph " + hashlib.sha1(generator + open(filename, "rb").read()).hexdigest() + " */\n"
+		if os.path.exists(hfile) and os.path.exists(cfile) and open(cfile).readline() == key:
+			continue
+		write_if_changed(hfile, capture(filename, False, True))
+		write_if_changed(cfile, key + capture(filename, True, False).replace('#include "glyphs.h"', '#include "glyph_' + bname + '.h"'))
+
+
+# options not depending on the position
+if "rle" in sys.argv:
+	sys.argv.remove("rle")
+	rle = True
+if "sizereport" in sys.argv:
+	sys.argv.remove("sizereport")
+	sizereport = True
+
+# glyphfragments <outdir> [rle] <imagefile>...
+if len(sys.argv) > 2 and sys.argv[1] == "glyphfragments":
+	if not os.path.isdir(sys.argv[2]):
+		os.makedirs(sys.argv[2])
+	glyphfragments(sys.argv[2], sys.argv[3:])
+	sys.exit(0)
+
+try:
+
+	# 2: python imagefile
+	if (len(sys.argv) == 2):
+		filename = sys.argv[1];
+		if not os.path.exists(filename):
+			sys.sterr.write(sys.argv[0] + ": [<Wmax> <Hmax>] <imagefile> [<forcedBPP>] [hexbitmaponly|glyphcfile|glyphcheader]\n")
+			sys.sterr.write("Error: " + sys.argv[1] + " does not exists !\n")
+			sys.exit(2)
+	# 3: python imagefile forcedBPP
+	# 3: python imagefile hexbitmaponly
+	elif (len(sys.argv) == 3):
+		filename = sys.argv[1];
+		if not os.path.exists(filename):
+			sys.sterr.write(sys.argv[0] + ": [<Wmax> <Hmax>] <imagefile> [<forcedBPP>] [hexbitmaponly|glyphcfile|glyphcheader]\n")
+			sys.sterr.write("Error: " + filename + " does not exists !\n")
+			sys.exit(2)
+		if (sys.argv[2] == "hexbitmaponly"):
+			hexbitmaponly = True
+		elif (sys.argv[2] == "glyphcfile"):
+			glyphcfile = True
+		elif (sys.argv[2] == "glyphcheader"):
+			glyphcheader = True
+		else:
+			forcedBPP = int(sys.argv[2])
+	# 4: python max max imagefile
+	# 4: python imagefile forcedBPP hexbitmaponly
+	elif (len(sys.argv) == 4):
+		filename = sys.argv[1];
+		if not os.path.exists(filename):
+			filename = sys.argv[3];
+			if not os.path.exists(filename):
+				sys.sterr.write(sys.argv[0] + ": [<Wmax> <Hmax>] <imagefile> [<forcedBPP>] [hexbitmaponly|glyphcfile|glyphcheader]\n")
+				sys.sterr.write("Error: " + filename + " does not exists !\n")
+				sys.exit(2)
+			widthmax = int(sys.argv[1])
+			heightmax = int(sys.argv[2])		
+		else:
+			forcedBPP = int(sys.argv[2])
+			if (sys.argv[3] == "hexbitmaponly"):
+				hexbitmaponly = True
+			elif (sys.argv[2] == "glyphcfile"):
+				glyphcfile = True
+			elif (sys.argv[2] == "glyphcheader"):
+				glyphcheader = True
+			else:
+				sys.sterr.write(sys.argv[0] + ": [<Wmax> <Hmax>] <imagefile> [<forcedBPP>] [hexbitmaponly|glyphcfile|glyphcheader]\n")
+				sys.exit(2)
+	# 5: python max max imagefile forcedBPP
+	# 5: python max max imagefile hexbitmaponly
+	elif (len(sys.argv) == 5):
+		filename = sys.argv[3];
+		if not os.path.exists(filename):
+			sys.sterr.write(sys.argv[0] + ": [<Wmax> <Hmax>] <imagefile> [<forcedBPP>] [hexbitmaponly|glyphcfile|glyphcheader]\n")
+			sys.sterr.write("Error: " + filename + " does not exists !\n")
+			sys.exit(2)
+		widthmax = int(sys.argv[1])
+		heightmax = int(sys.argv[2])		
+
+		if (sys.argv[4] == "hexbitmaponly"):
+			hexbitmaponly = True
+		elif (sys.argv[2] == "glyphcfile"):
+			glyphcfile = True
+		elif (sys.argv[2] == "glyphcheader"):
+			glyphcheader = True
+		else:
+			forcedBPP = int(sys.argv[4])
+
+	# 6: python max max imagefile forcedBPP hexbitmaponly
+	elif (len(sys.argv) == 6):
+		filename = sys.argv[3]
+		if not os.path.exists(filename):
+			sys.sterr.write(sys.argv[0] + ": [<Wmax> <Hmax>] <imagefile> [<forcedBPP>] [hexbitmaponly|glyphcfile|glyphcheader]\n")
+			sys.sterr.write("Error: " + filename + " does not exists !\n")
+			sys.exit(2)
+		widthmax = int(sys.argv[1])
+		heightmax = int(sys.argv[2])		
+		forcedBPP = int(sys.argv[4])
+		if (sys.argv[5] == "hexbitmaponly"):
+			hexbitmaponly = True
+		elif (sys.argv[2] == "glyphcfile"):
+			glyphcfile = True
+		elif (sys.argv[2] == "glyphcheader"):
+			glyphcheader = True
+		else:
+			sys.sterr.write(sys.argv[0] + ": [<Wmax> <Hmax>] <imagefile> [<forcedBPP>] [hexbitmaponly|glyphcfile|glyphcheader]\n")
+			sys.sterr.write("Error: " + filename + " does not exists !\n")
+			sys.exit(2)
+	else:
+		sys.sterr.write(sys.argv[0] + ": [<Wmax> <Hmax>] <imagefile> [<forcedBPP>] [hexbitmaponly|glyphcfile|glyphcheader]\n")
+		sys.sterr.write("Error: " + sys.argv[1] + " does not exists !\n")
+		sys.exit(2)
+
+
+	glyph(filename, widthmax, heightmax, forcedBPP, hexbitmaponly, glyphcfile, glyphcheader)
 except:
 	sys.stderr.write("An error occured\n")
 	#traceback.print_exc()
@@ -72,14 +72,59 @@ int setjmp(jmp_buf __jmpb);
 #define WIDE_NULL ((void WIDE *)0)
 #endif
 
+#ifdef HAVE_PIC_STATS
+/**
+ * PIC accounting: out of line pic() calls, addresses translated (by pic() or
+ * the cached fast path), and screen redraws for per redraw figures. Kept out
+ * of the PIC guard, the ux macros count redraws when PIC is overridden too.
+ */
+typedef struct pic_stats_s {
+    unsigned int calls;
+    unsigned int translations;
+    unsigned int redraws;
+} pic_stats_t;
+extern pic_stats_t G_pic_stats;
+#define PIC_STATS_CALL() G_pic_stats.calls++
+#define PIC_STATS_TRANSLATION() G_pic_stats.translations++
+#define PIC_STATS_REDRAW() G_pic_stats.redraws++
+#else // HAVE_PIC_STATS
+#define PIC_STATS_CALL()
+#define PIC_STATS_TRANSLATION()
+#define PIC_STATS_REDRAW()
+#endif // HAVE_PIC_STATS
+
 // Placement Independence Code reference
 // function that align the deferenced value in a rom struct to use it depending
 // on the execution address
 // can be used even if code is executing at the same place where it had been
 // linked
 #ifndef PIC
-#define PIC(x) pic((unsigned int)x)
 unsigned int pic(unsigned int linked_address);
+
+// bounds of the linked code and constants (script.ld)
+extern unsigned int _nvram;
+extern unsigned int _envram;
+
+#ifdef HAVE_PIC_CACHE
+/**
+ * Delta between the link and the execution addresses, computed once by
+ * os_boot. PIC() is then an inline range check and subtraction, instead of a
+ * call to pic() computing the delta from pc each time.
+ */
+extern unsigned int G_pic_delta;
+void pic_cache_init(void);
+static inline unsigned int pic_cached(unsigned int link_address) {
+    if (link_address - (unsigned int)&_nvram <
+        (unsigned int)&_envram - (unsigned int)&_nvram) {
+        PIC_STATS_TRANSLATION();
+        return link_address - G_pic_delta;
+    }
+    return link_address;
+}
+#define PIC(x) pic_cached((unsigned int)x)
+#else // HAVE_PIC_CACHE
+#define PIC(x) pic((unsigned int)x)
+#endif // HAVE_PIC_CACHE
 #endif
 
 #ifndef SYSCALL
@@ -195,6 +240,51 @@ extern unsigned char G_io_apdu_buffer[IO_APDU_BUFFER_SIZE];
 
 extern try_context_t *G_try_last_open_context;
 
+#ifdef HAVE_TRY_STATS
+/**
+ * Exception frames accounting, to measure the setjmp/longjmp cost of a code
+ * path. Reset it before the path to measure, and read it afterwards.
+ */
+typedef struct try_stats_s {
+    // number of TRY entered, that is setjmp calls
+    unsigned int frames;
+    // number of THROW, that is longjmp calls
+    unsigned int throws;
+    // deepest chain of open exception contexts
+    unsigned int max_depth;
+    // lowest exception context address, to compute the stack depth
+    unsigned int min_frame_address;
+} try_stats_t;
+
+extern try_stats_t G_try_stats;
+
+void try_stats_reset(void);
+void try_stats_enter(try_context_t *context);
+#define TRY_STATS_ENTER(context) try_stats_enter(context)
+#define TRY_STATS_THROW() G_try_stats.throws++
+#else // HAVE_TRY_STATS
+#define TRY_STATS_ENTER(context)
+#endif // HAVE_TRY_STATS
+
+#ifdef HAVE_STACK_PAINT
+/**
+ * Fill the free part of the stack with a known pattern. Called by os_boot, it
+ * can be called again to measure a given code path.
+ */
+void os_stack_paint(void);
+
+/**
+ * Return the deepest stack usage in bytes since the last paint, the stack top
+ * being _estack.
+ */
+unsigned int os_stack_max_usage(void);
+
+/**
+ * Return the stack room in bytes, from the end of the .bss to _estack.
+ */
+unsigned int os_stack_size(void);
+#endif // HAVE_STACK_PAINT
+
 #define CUSTOMCA_MAXLEN 64
 
 /* ----------------------------------------------------------------------- */
@@ -263,6 +353,52 @@ typedef enum {
 } io_apdu_media_t;
 
 extern volatile io_apdu_media_t G_io_apdu_media;
+
+#ifdef HAVE_IO_APDU_QUEUE
+/**
+ * Received commands queue.
+ * While a command is processed (G_io_apdu_media != IO_APDU_MEDIA_NONE), the
+ * next ones are reassembled in spare buffers instead of being dropped, and
+ * io_exchange delivers them in order as soon as the reply has been sent,
+ * without a round trip to the host.
+ */
+#ifndef IO_APDU_QUEUE_DEPTH
+#define IO_APDU_QUEUE_DEPTH 1
+#endif // IO_APDU_QUEUE_DEPTH
+
+typedef struct io_apdu_queue_entry_s {
+    unsigned short length;
+    // io_apdu_media_t the command has been received from
+    unsigned char media;
+    unsigned char buffer[IO_APDU_BUFFER_SIZE];
+} io_apdu_queue_entry_t;
+
+typedef struct io_apdu_queue_s {
+    // oldest received entry
+    unsigned char head;
+    // received entries, not delivered yet
+    unsigned char count;
+    // commands dropped because the queue was full
+    unsigned short dropped;
+} io_apdu_queue_t;
+
+extern io_apdu_queue_t G_io_apdu_queue;
+
+/**
+ * Buffer the next command is to be received in: G_io_apdu_buffer when no
+ * command is processed nor queued, else a free queue entry. NULL when the
+ * queue is full (the command is dropped).
+ */
+unsigned char *io_apdu_queue_rx_buffer(void);
+// the command received in the entry returned by io_apdu_queue_rx_buffer is
+// complete
+void io_apdu_queue_push(io_apdu_media_t media, unsigned short length);
+// the oldest queued command is moved to G_io_apdu_buffer as if just received,
+// its length is returned, 0 when the queue is empty
+unsigned short io_apdu_queue_pop(void);
+void io_apdu_queue_reset(void);
+#endif // HAVE_IO_APDU_QUEUE
+
 /**
  * Return 1 when the event has been processed, 0 else
  */
@@ -284,6 +420,9 @@ SYSCALL void nvm_write(void WIDE *dst_adr PLENGTH(src_len),
                        void WIDE *src_adr PLENGTH(src_len),
                        unsigned int src_len);
 
+// flash page programmed by nvm_write, PAGE_SIZE of script.ld
+#define NVM_PAGE_SIZE 64
+
 /* ----------------------------------------------------------------------- */
 /* -                            EXCEPTIONS                               - */
 /* ----------------------------------------------------------------------- */
@@ -309,7 +448,8 @@ SYSCALL void nvm_write(void WIDE *dst_adr PLENGTH(src_len),
     __try                                                                      \
         ##L.ex = setjmp(__try##L.jmp_buf);                                     \
     G_try_last_open_context = &__try##L;                                       \
-    if (__try##L.ex == 0) {
+    if (__try##L.ex == 0) {                                                    \
+        TRY_STATS_ENTER(&__try##L);
 // -----------------------------------------------------------------------
 // - EXCEPTION CATCH
 // -----------------------------------------------------------------------
@@ -378,7 +518,12 @@ void os_longjmp(jmp_buf b, unsigned int exception);
 
 #else
 */
+#ifdef HAVE_TRY_STATS
+#define THROW_L(L, x)                                                          \
+    (TRY_STATS_THROW(), longjmp(G_try_last_open_context->jmp_buf, x))
+#else // HAVE_TRY_STATS
 #define THROW_L(L, x) longjmp(G_try_last_open_context->jmp_buf, x)
+#endif // HAVE_TRY_STATS
 /*
 #endif // BOLOS_RELEASE
 */
@@ -422,8 +567,13 @@ void os_longjmp(jmp_buf b, unsigned int exception);
 #define U2LE(buf, off) ((((buf)[off + 1] & 0xFF) << 8) | ((buf)[off] & 0xFF))
 #define U4BE(buf, off) ((U2BE(buf, off) << 16) | (U2BE(buf, off + 2) & 0xFFFF))
 #define U4LE(buf, off) ((U2LE(buf, off + 2) << 16) | (U2LE(buf, off) & 0xFFFF))
+// also defined by usbd_def.h
+#ifndef MIN
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
+#endif // MIN
+#ifndef MAX
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
+#endif // MAX
 #define IS_POW2(x) (((x) & ((x)-1)) == 0)
 
 #ifdef macro_offsetof
@@ -799,9 +949,13 @@ typedef enum io_usb_hid_receive_status_e {
     IO_USB_APDU_RESET,
     IO_USB_APDU_MORE_DATA,
     IO_USB_APDU_RECEIVED,
+    // received while the previous command is processed, see HAVE_IO_APDU_QUEUE
+    IO_USB_APDU_QUEUED,
 } io_usb_hid_receive_status_t;
 
 extern volatile unsigned int G_io_usb_hid_total_length;
+// non zero while a command is being reassembled
+extern volatile unsigned int G_io_usb_hid_sequence_number;
 
 void io_usb_hid_init(void);
 
@@ -0,0 +1,129 @@
+/*******************************************************************************
+*   Ledger Nano S - Secure firmware
+*   (c) 2016, 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#ifndef OS_FORMAT_H
+#define OS_FORMAT_H
+
+#include "os.h"
+
+#ifdef HAVE_FORMAT
+
+/**
+ * Compact formatting.
+ * Instead of a format string parsed at runtime, the output is described at
+ * compile time as a list of items, each item being a call to a specialized
+ * emitter:
+ *
+ *   FORMAT(buf, F_STR("fees ") F_AMOUNT(fees, 8) F_STR(" to ") F_HEX(h, 4));
+ *
+ * FORMAT evaluates to the length written, the output is always zero
+ * terminated and truncated to the buffer size.
+ */
+
+#define FORMAT_FLAG_TRUNCATED 0x01
+// writes wrap around a power of 2 sized buffer (log ring)
+#define FORMAT_FLAG_RING 0x02
+
+typedef struct format_s {
+    char *buf;
+    unsigned short size;
+    // written length, or write position in the ring
+    unsigned short len;
+    unsigned char flags;
+} format_t;
+
+void format_init(format_t *f, char *buf, unsigned int size);
+void format_char(format_t *f, char c);
+// zero terminated string, linked addresses are PIC'd
+void format_str(format_t *f, const char WIDE *str);
+void format_u32(format_t *f, uint32_t value);
+void format_s32(format_t *f, int32_t value);
+// value in hexadecimal, on digits characters (leading zeros)
+void format_x32(format_t *f, uint32_t value, unsigned int digits);
+// hex dump of the data
+void format_hex(format_t *f, const void WIDE *data, unsigned int length);
+// fixed point amount, value / 10^decimals, trailing zeros removed. Throws
+// INVALID_PARAMETER above FORMAT_AMOUNT_MAX_DECIMALS
+#define FORMAT_AMOUNT_MAX_DECIMALS 19
+void format_amount(format_t *f, uint64_t value, unsigned int decimals);
+// end of the output, zero terminated, length returned
+unsigned int format_end(format_t *f);
+
+// items, emitted on the FORMAT or LOG cursor
+#define F_CHR(c) format_char(&__fmt, c);
+#define F_STR(str) format_str(&__fmt, str);
+#define F_U32(value) format_u32(&__fmt, value);
+#define F_S32(value) format_s32(&__fmt, value);
+#define F_X8(value) format_x32(&__fmt, value, 2);
+#define F_X16(value) format_x32(&__fmt, value, 4);
+#define F_X32(value) format_x32(&__fmt, value, 8);
+#define F_HEX(data, length) format_hex(&__fmt, data, length);
+#define F_AMOUNT(value, decimals) format_amount(&__fmt, value, decimals);
+
+#define FORMAT(buf, items)                                                     \
+    ({                                                                         \
+        format_t __fmt;                                                        \
+        format_init(&__fmt, buf, sizeof(buf));                                 \
+        items format_end(&__fmt);                                              \
+    })
+
+#ifdef HAVE_LOG_RING
+
+/**
+ * Log ring sink. Records are formatted in place in a RAM ring, the oldest
+ * ones being overwritten, and read back with log_ring_read. No format string
+ * and no intermediate buffer, cheap enough to be kept in release builds.
+ */
+
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 128
+#endif // LOG_RING_SIZE
+
+typedef struct log_ring_s {
+    // bytes ever written, the ring holds the last LOG_RING_SIZE ones
+    uint32_t written;
+    char data[LOG_RING_SIZE];
+} log_ring_t;
+
+typedef char log_ring_size_must_be_a_power_of_2
+    [(LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0 ? 1 : -1];
+
+extern log_ring_t G_log_ring;
+
+void log_ring_open(format_t *f);
+void log_ring_close(format_t *f);
+// copy the ring content, oldest first, the copied length is returned
+unsigned int log_ring_read(unsigned char *out, unsigned int out_size);
+
+// a record, terminated with a new line
+#define LOG(items)                                                             \
+    do {                                                                       \
+        format_t __fmt;                                                        \
+        log_ring_open(&__fmt);                                                 \
+        items log_ring_close(&__fmt);                                          \
+    } while (0)
+
+#endif // HAVE_LOG_RING
+
+#endif // HAVE_FORMAT
+
+// records are dropped, items not evaluated, without the log ring
+#ifndef LOG
+#define LOG(items)
+#endif // LOG
+
+#endif // OS_FORMAT_H
@@ -0,0 +1,99 @@
+/*******************************************************************************
+*   Ledger Nano S - Secure firmware
+*   (c) 2016, 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#ifndef OS_IO_OVERLAY_H
+#define OS_IO_OVERLAY_H
+
+#include "os.h"
+
+#ifdef HAVE_IO_OVERLAY
+
+/**
+ * I/O buffers overlay.
+ * Transport buffers which are never live at the same time share the same
+ * SRAM. Each overlay member is declared with the transport phases it is live
+ * in, members of the overlay shall have disjoint phases, this is checked at
+ * compile time, and at runtime when HAVE_IO_OVERLAY_CHECK is defined.
+ *
+ * The application provides io_overlay_app.h, defining
+ * IO_OVERLAY_APP_MEMBERS(X) as a list of X(name, type, phases).
+ */
+
+// Ledger HID framing of APDUs
+#define IO_PHASE_USB_HID (1 << 0)
+// FIDO U2F HID framing
+#define IO_PHASE_U2F (1 << 1)
+// CCID bulk transport
+#define IO_PHASE_CCID (1 << 2)
+// first phase free for application specific purposes
+#define IO_PHASE_APP (1 << 8)
+
+typedef struct io_usb_hid_overlay_s {
+    unsigned char chunk[IO_HID_EP_LENGTH];
+#ifdef HAVE_IO_APDU_QUEUE
+    // next commands, reassembled while the current one is processed. Only
+    // free when larger application members share the overlay, else they add
+    // to the SRAM used
+    io_apdu_queue_entry_t apdu_queue[IO_APDU_QUEUE_DEPTH];
+#endif // HAVE_IO_APDU_QUEUE
+} io_usb_hid_overlay_t;
+
+#include "io_overlay_app.h"
+
+#define IO_OVERLAY_MEMBERS(X)                                                  \
+    X(usb_hid, io_usb_hid_overlay_t, IO_PHASE_USB_HID)                         \
+    IO_OVERLAY_APP_MEMBERS(X)
+
+#define IO_OVERLAY_MEMBER_DECLARE(name, type, phases) type name;
+
+typedef union io_overlay_u {
+    IO_OVERLAY_MEMBERS(IO_OVERLAY_MEMBER_DECLARE)
+} io_overlay_t;
+
+extern io_overlay_t G_io_overlay;
+
+// phases are disjoint when no bit is shared, that is when adding them is the
+// same as or'ing them
+#define IO_OVERLAY_MEMBER_SUM(name, type, phases) +(phases)
+#define IO_OVERLAY_MEMBER_OR(name, type, phases) | (phases)
+typedef char io_overlay_phases_must_be_disjoint
+    [((0 IO_OVERLAY_MEMBERS(IO_OVERLAY_MEMBER_SUM)) ==
+      (0 IO_OVERLAY_MEMBERS(IO_OVERLAY_MEMBER_OR)))
+         ? 1
+         : -1];
+
+// SDK buffers placed in the overlay
+#define G_io_hid_chunk (G_io_overlay.usb_hid.chunk)
+#ifdef HAVE_IO_APDU_QUEUE
+#define G_io_apdu_queue_entries (G_io_overlay.usb_hid.apdu_queue)
+#endif // HAVE_IO_APDU_QUEUE
+
+#ifdef HAVE_IO_OVERLAY_CHECK
+/**
+ * Enter/leave a transport phase. An exception EXCEPTION_IO_STATE is thrown
+ * when two overlay members become live at the same time.
+ */
+void io_overlay_enter(unsigned int phases);
+void io_overlay_leave(unsigned int phases);
+#else // HAVE_IO_OVERLAY_CHECK
+#define io_overlay_enter(phases)
+#define io_overlay_leave(phases)
+#endif // HAVE_IO_OVERLAY_CHECK
+
+#endif // HAVE_IO_OVERLAY
+
+#endif // OS_IO_OVERLAY_H
@@ -130,6 +130,23 @@ void io_seproxyhal_init(void);
 // only reinit ux related globals
 void io_seproxyhal_init_ux(void);
 
+#ifdef HAVE_IO_WARM_RESET
+// set before EXCEPTION_IO_RESET is thrown when the USB link is lost, the
+// device has to be powered and enumerated again
+#define IO_RESET_FLAG_USB_UNPOWERED 0x01
+extern unsigned char G_io_reset_flags;
+
+/**
+ * Warm reset, to be called upon EXCEPTION_IO_RESET instead of
+ * io_seproxyhal_init. Only the transport state machines (APDU state, HID
+ * sequence, CCID bulk state) are reset, the USB device stays configured and
+ * the host does not enumerate it again. Returns 0 when the USB device is not
+ * configured anymore (or the link has been lost), the caller then goes
+ * through the full io_seproxyhal_init and USB power sequence.
+ */
+unsigned int io_seproxyhal_warm_reset(void);
+#endif // HAVE_IO_WARM_RESET
+
 // only init button handling related variables (not to be done when switching
 // screen to avoid the release triggering unwanted behavior)
 void io_seproxyhal_init_button(void);
@@ -166,6 +183,36 @@ void io_usb_send_apdu_data(unsigned char *buffer, unsigned short length);
 void io_usb_send_ep(unsigned int ep, unsigned char *buffer,
                     unsigned short length, unsigned int timeout);
 
+#ifdef HAVE_IO_USB_TX_QUEUE
+#ifndef IO_USB_TX_QUEUE_DEPTH
+#define IO_USB_TX_QUEUE_DEPTH 2
+#endif // IO_USB_TX_QUEUE_DEPTH
+
+// called on the event path when the host has read the buffer
+typedef void (*io_usb_tx_done_t)(unsigned int ep, unsigned char *buffer,
+                                 unsigned short length);
+
+/**
+ * Asynchronous IN transfers. Buffers posted on an endpoint are sent in
+ * order, one at a time, the next one being started upon the transfer
+ * completion event (USBD_LL_DataInStage path). Buffers are not copied and
+ * must stay untouched until their done callback (which may be NULL).
+ * A transfer posted outside of an event (general status already sent) is
+ * started before the general status of the next event, whatever its kind,
+ * or by io_usb_tx_kick. An endpoint is either
+ * driven by the queue or by io_usb_send_ep, never both.
+ * Returns 0 when the endpoint queue is full.
+ */
+unsigned int io_usb_tx_post(unsigned int ep, unsigned char *buffer,
+                            unsigned short length, io_usb_tx_done_t done);
+// number of transfers posted on the endpoint and not completed yet
+unsigned int io_usb_tx_pending(unsigned int ep);
+// start the transfers posted outside of an event, if possible
+void io_usb_tx_kick(void);
+// drop all posted transfers, without calling their callback
+void io_usb_tx_reset(void);
+#endif // HAVE_IO_USB_TX_QUEUE
+
 void io_usb_ccid_reply(unsigned char *buffer, unsigned short length);
 
 typedef enum {
@@ -270,6 +317,87 @@ typedef struct ux_state_s {
 } ux_state_t;
 extern ux_state_t ux;
 
+#ifdef HAVE_UX_SCENE
+
+#ifndef UX_SCENE_MAX_ELEMENTS
+#define UX_SCENE_MAX_ELEMENTS 16
+#endif // UX_SCENE_MAX_ELEMENTS
+
+// elements are tracked in 32 bits masks
+#if UX_SCENE_MAX_ELEMENTS > 32
+#error UX_SCENE_MAX_ELEMENTS is at most 32
+#endif // UX_SCENE_MAX_ELEMENTS
+
+/**
+ * Retained scene, the elements last sent to the MCU.
+ * Each element is retained as a hash of its component and text (0 when not
+ * displayed) and its bounding box. Upon UX_REDISPLAY, only the elements which
+ * changed, and the ones overlapping the area they cover(ed), are sent again.
+ * The preprocessor runs once per element, when planning the redisplay, the
+ * preprocessed elements are kept until sent: the text they point to must not
+ * change until the redisplay completes.
+ * Unchanged filled rectangles (backgrounds) are clipped to that area.
+ * UX_DISPLAY and an os ux redraw request always redisplay the whole screen.
+ * Screens with more than UX_SCENE_MAX_ELEMENTS elements are not retained.
+ * Note a UX_REDISPLAY with nothing changed sends nothing, therefore no display
+ * processed event is to be received.
+ */
+typedef struct ux_scene_rect_s {
+    short x;
+    short y;
+    unsigned short width;
+    unsigned short height;
+} ux_scene_rect_t;
+
+typedef struct ux_scene_s {
+    const bagl_element_t *elements;
+    // 0 when the scene is not retained (invalidated or too large)
+    unsigned int elements_count;
+    unsigned int hash[UX_SCENE_MAX_ELEMENTS];
+    ux_scene_rect_t rect[UX_SCENE_MAX_ELEMENTS];
+    // elements to be sent during the current redisplay
+    unsigned int redraw_mask;
+    // unchanged filled rectangles, only sent clipped to the dirty area
+    unsigned int clip_mask;
+    // area to be redrawn, grows while elements are sent
+    ux_scene_rect_t dirty;
+    // preprocessed elements, clipped in place when sent
+    bagl_element_t element[UX_SCENE_MAX_ELEMENTS];
+} ux_scene_t;
+extern ux_scene_t ux_scene;
+
+/**
+ * Forget the retained scene, the next redisplay sends all elements.
+ */
+void ux_scene_invalidate(void);
+
+/**
+ * Compare the screen elements with the retained ones and prepare the redraw
+ * of the elements from the given index.
+ */
+void ux_scene_plan(unsigned int index);
+
+/**
+ * Return the preprocessed element planned for the given index, possibly
+ * clipped, or NULL when the MCU already displays it. Only valid while the
+ * scene is retained.
+ */
+const bagl_element_t *ux_scene_element(unsigned int index);
+
+#define UX_SCENE_INVALIDATE() ux_scene_invalidate();
+#define UX_SCENE_PLAN(index) ux_scene_plan(index);
+#define UX_SCENE_RETAINED() (ux_scene.elements_count != 0)
+#define UX_SCENE_ELEMENT(index) ux_scene_element(index)
+
+#else // HAVE_UX_SCENE
+
+#define UX_SCENE_INVALIDATE()
+#define UX_SCENE_PLAN(index)
+#define UX_SCENE_RETAINED() 0
+#define UX_SCENE_ELEMENT(index) NULL
+
+#endif // HAVE_UX_SCENE
+
 /**
  * Initialize the user experience structure
  */
@@ -295,13 +423,18 @@ extern ux_state_t ux;
     while (ux.elements && ux.elements_current < ux.elements_count &&           \
            !io_seproxyhal_spi_is_status_sent()) {                              \
         const bagl_element_t *element = &ux.elements[ux.elements_current];     \
-        if (!ux.elements_preprocessor ||                                       \
-            (element = ux.elements_preprocessor(element))) {                   \
+        /* a retained scene already holds the preprocessed elements */         \
+        if (UX_SCENE_RETAINED()) {                                             \
+            element = UX_SCENE_ELEMENT(ux.elements_current);                   \
+        } else if (ux.elements_preprocessor) {                                 \
+            element = ux.elements_preprocessor(element);                       \
             if ((unsigned int)element ==                                       \
                 1) { /*backward compat with coding to avoid smashing           \
                         everything*/                                           \
                 element = &ux.elements[ux.elements_current];                   \
             }                                                                  \
+        }                                                                      \
+        if (element) {                                                         \
             io_seproxyhal_display(element);                                    \
             ux.elements_current++;                                             \
             break;                                                             \
@@ -328,6 +461,8 @@ extern ux_state_t ux;
     /* REDRAW is redisplay already */                                          \
     if (ux.params.len != BOLOS_UX_IGNORE &&                                    \
         ux.params.len != BOLOS_UX_CONTINUE) {                                  \
+        PIC_STATS_REDRAW();                                                    \
+        UX_SCENE_PLAN(index);                                                  \
         UX_DISPLAY_NEXT_ELEMENT();                                             \
     }
 
@@ -342,6 +477,7 @@ extern ux_state_t ux;
     ux.button_push_handler = elements_array##_button;                          \
     ux.elements_preprocessor = preprocessor;                                   \
     UX_WAKE_UP();                                                              \
+    UX_SCENE_INVALIDATE();                                                     \
     UX_REDISPLAY();
 
 /**
@@ -361,6 +497,7 @@ extern ux_state_t ux;
     ux.params.len = os_ux(&ux.params);                                         \
     if (ux.params.len == BOLOS_UX_REDRAW) {                                    \
         UX_WAKE_UP();                                                          \
+        UX_SCENE_INVALIDATE();                                                 \
         UX_REDISPLAY();                                                        \
     } else if (!ignoring_app_if_ux_busy ||                                     \
                (ux.params.len != BOLOS_UX_IGNORE &&                            \
@@ -471,6 +608,12 @@ void io_seproxyhal_disable_io(void);
 void io_seproxyhal_backlight(unsigned int flags,
                              unsigned int backlight_percentage);
 
+// bitmap encodings of an icon
+// packed pixels, row first
+#define BAGL_ICON_FORMAT_RAW 0
+// packbits encoded packed pixels, see icon.py
+#define BAGL_ICON_FORMAT_RLE 1
+
 /**
  * helper structure to help handling icons
  */
@@ -481,11 +624,17 @@ typedef struct bagl_icon_details_s {
     unsigned int bpp;
     const unsigned int *colors;
     const unsigned char *bitmap;
+#ifdef HAVE_GLYPH_RLE
+    // BAGL_ICON_FORMAT_*
+    unsigned int format;
+#endif // HAVE_GLYPH_RLE
 } bagl_icon_details_t;
 
 /**
  * Helper function to send the given bitmap splitting into multiple DISPLAY_RAW
  * packet as the bitmap is not meant to fit in a single SEPROXYHAL packet.
+ * With HAVE_DISPLAY_RAW_STREAM, the chunks are streamed under the credits of
+ * the MCU, which must support SCREEN_DISPLAY_RAW_STATUS_STREAM_START.
  */
 void io_seproxyhal_display_icon(bagl_component_t *icon_component,
                                 bagl_icon_details_t *icon_details);
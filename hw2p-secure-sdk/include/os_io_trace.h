@@ -0,0 +1,144 @@
+/*******************************************************************************
+*   Ledger Nano S - Secure firmware
+*   (c) 2016, 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#ifndef OS_IO_TRACE_H
+#define OS_IO_TRACE_H
+
+#include "os.h"
+#include "os_io_seproxyhal.h"
+
+#ifdef HAVE_IO_TRACE
+
+/**
+ * I/O trace ring.
+ * The SEPROXYHAL packets, USB transfers and APDU boundaries are recorded in
+ * a fixed size binary ring in SRAM, the oldest records being overwritten.
+ * Recording is a handful of stores, cheap enough to be kept in release
+ * builds. The ring is dumped with io_trace_dump and rendered by io_trace.py.
+ * The SEPROXYHAL packets are recorded by the sources including this header,
+ * their io_seproxyhal_spi_send/recv calls go through the tracing wrappers.
+ */
+
+#ifndef IO_TRACE_SIZE
+#define IO_TRACE_SIZE 16
+#endif // IO_TRACE_SIZE
+
+typedef char io_trace_size_must_be_a_power_of_2
+    [IS_POW2(IO_TRACE_SIZE) ? 1 : -1];
+
+// trace points, keep in sync with io_trace.py
+// packet received, tag, ep: byte 3, length: received
+#define IO_TRACE_SPI_RECV 0x01
+// command sent from G_io_seproxyhal_spi_buffer, tag, ep: byte 3, length: TLV
+// length (payloads sent from other buffers are not recorded)
+#define IO_TRACE_SPI_SEND 0x02
+// USB transfer handled, tag: SETUP/IN/OUT, ep, length: data length
+#define IO_TRACE_EP_XFER 0x03
+// command delivered to the application by io_exchange, length
+#define IO_TRACE_APDU_RX 0x04
+// reply handed to io_exchange, length
+#define IO_TRACE_APDU_TX 0x05
+// command received while the previous one is processed (HAVE_IO_APDU_QUEUE)
+#define IO_TRACE_APDU_QUEUED 0x06
+
+typedef struct io_trace_record_s {
+    // ms since power on, low 16 bits, as of the last ticker event
+    unsigned short tick;
+    unsigned short length;
+    unsigned char point;
+    unsigned char tag;
+    unsigned char ep;
+    // G_io_apdu_state
+    unsigned char state;
+} io_trace_record_t;
+
+typedef struct io_trace_s {
+    // records ever written, the ring holds the last IO_TRACE_SIZE ones
+    uint32_t written;
+    // ms since power on, from the last ticker event
+    uint32_t tick;
+    io_trace_record_t records[IO_TRACE_SIZE];
+} io_trace_t;
+
+extern io_trace_t G_io_trace;
+
+static inline void io_trace(unsigned int point, unsigned int tag,
+                            unsigned int ep, unsigned int length) {
+    io_trace_record_t *record =
+        &G_io_trace.records[G_io_trace.written++ & (IO_TRACE_SIZE - 1)];
+    record->tick = G_io_trace.tick;
+    record->length = length;
+    record->point = point;
+    record->tag = tag;
+    record->ep = ep;
+    record->state = G_io_apdu_state;
+}
+
+// ticker events only advance the time base, and general status are not
+// recorded, they would flush the ring within a second when idle
+static inline void io_trace_spi_recv(const unsigned char *buffer,
+                                     unsigned int length) {
+    if (buffer[0] == SEPROXYHAL_TAG_TICKER_EVENT) {
+        G_io_trace.tick = U4BE(buffer, 3);
+        return;
+    }
+    io_trace(IO_TRACE_SPI_RECV, buffer[0], buffer[3], length);
+}
+
+static inline void io_trace_spi_send(const unsigned char *buffer) {
+    if (buffer == G_io_seproxyhal_spi_buffer &&
+        buffer[0] != SEPROXYHAL_TAG_GENERAL_STATUS) {
+        io_trace(IO_TRACE_SPI_SEND, buffer[0], buffer[3], U2BE(buffer, 1));
+    }
+}
+
+/**
+ * Dump: records written (4BE) | tick (4BE) | records, oldest first, each as
+ * tick (2BE) length (2BE) point tag ep state. Only whole records are copied,
+ * the most recent ones when out is too small. The dump length is returned.
+ */
+unsigned int io_trace_dump(unsigned char *out, unsigned int out_size);
+
+static inline void io_trace_spi_send_packet(const unsigned char *buffer,
+                                            unsigned short length) {
+    io_trace_spi_send(buffer);
+    io_seproxyhal_spi_send(buffer, length);
+}
+
+static inline unsigned short io_trace_spi_recv_packet(unsigned char *buffer,
+                                                      unsigned short maxlength,
+                                                      unsigned int flags) {
+    unsigned short length = io_seproxyhal_spi_recv(buffer, maxlength, flags);
+    io_trace_spi_recv(buffer, length);
+    return length;
+}
+
+// the syscall stubs (syscalls.c) are generated, calls are wrapped instead
+#define io_seproxyhal_spi_send(buffer, length)                                 \
+    io_trace_spi_send_packet(buffer, length)
+#define io_seproxyhal_spi_recv(buffer, maxlength, flags)                       \
+    io_trace_spi_recv_packet(buffer, maxlength, flags)
+
+#define IO_TRACE(point, tag, ep, length) io_trace(point, tag, ep, length)
+
+#else // HAVE_IO_TRACE
+
+#define IO_TRACE(point, tag, ep, length)
+
+#endif // HAVE_IO_TRACE
+
+#endif // OS_IO_TRACE_H
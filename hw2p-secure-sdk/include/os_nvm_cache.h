@@ -0,0 +1,130 @@
+/*******************************************************************************
+*   Ledger Blue - Secure firmware
+*   (c) 2016, 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#ifndef OS_NVM_CACHE_H
+#define OS_NVM_CACHE_H
+
+#include "os.h"
+
+#ifdef HAVE_NVM_CACHE
+
+/**
+ * Write-back NVRAM cache.
+ * nvm_cache_write updates a RAM copy of the written pages instead of
+ * programming them. The dirty pages are committed as one batch, when the
+ * reply to a command is sent (io_exchange), a page written several times
+ * being programmed once. Reads of the written variables go through
+ * nvm_cache_map until the commit.
+ *
+ * Commit: the dirty pages are copied to a journal slot, then its header
+ * (commit marker) is written, then the pages are programmed. A journal
+ * without a valid header is ignored at boot, a valid one is replayed by
+ * nvm_cache_init, pages already up to date being skipped: after a power
+ * loss, the batch is found either completely or not at all.
+ *
+ * Journal slot: header page | NVM_CACHE_PAGES data pages
+ * Header: magic 'N' 'C', sequence, count, page index (2LE) from _nvram of
+ * each data page, crc16 (LE) over the header and the count data pages
+ *
+ * Slots are used round robin, spreading the programs of the journal over
+ * NVM_CACHE_JOURNALS slots, the valid one with the newest sequence is
+ * replayed.
+ *
+ * A batch made of a single page written with nvm_cache_write_checked only,
+ * and not part of the newest journal, is programmed in place without the
+ * journal.
+ *
+ * NVM_CACHE_PAGES is the largest batch of a command: EXCEPTION_OVERFLOW is
+ * thrown when a command writes more pages, a batch is never split.
+ */
+
+#ifndef NVM_CACHE_PAGES
+#define NVM_CACHE_PAGES 2
+#endif // NVM_CACHE_PAGES
+
+#ifndef NVM_CACHE_JOURNALS
+#define NVM_CACHE_JOURNALS 8
+#endif // NVM_CACHE_JOURNALS
+
+// the sequence wraps on the slot count
+typedef char nvm_cache_journals_must_be_a_power_of_2
+    [IS_POW2(NVM_CACHE_JOURNALS) ? 1 : -1];
+typedef char nvm_cache_pages_must_fit_a_byte
+    [(NVM_CACHE_PAGES <= 255) ? 1 : -1];
+
+typedef struct nvm_cache_page_s {
+    // page index from _nvram
+    unsigned short page;
+    unsigned char data[NVM_PAGE_SIZE];
+} nvm_cache_page_t;
+
+typedef struct nvm_cache_s {
+    nvm_cache_page_t pages[NVM_CACHE_PAGES];
+    // dirty pages
+    unsigned char count;
+    // a page of the batch was written with nvm_cache_write
+    unsigned char journal;
+    // sequence of the last journal written
+    unsigned char sequence;
+} nvm_cache_t;
+
+extern nvm_cache_t G_nvm_cache;
+
+/**
+ * Replay the last committed batch if its pages were not all programmed.
+ * To be called at boot, before the NVRAM is read.
+ */
+void nvm_cache_init(void);
+
+/**
+ * Same as nvm_write, the written pages are kept in the cache until the next
+ * commit. EXCEPTION_OVERFLOW is thrown when the batch would exceed
+ * NVM_CACHE_PAGES pages.
+ * @param src_adr NULL to fill with 00's
+ */
+void nvm_cache_write(void WIDE *dst_adr, void WIDE *src_adr,
+                     unsigned int src_len);
+
+/**
+ * Same as nvm_cache_write, for data which is checked when read back and
+ * whose page holds no other live data (key-value store records): losing the
+ * page program to a power loss only loses this write.
+ */
+void nvm_cache_write_checked(void WIDE *dst_adr, void WIDE *src_adr,
+                             unsigned int src_len);
+
+/**
+ * Address where NVRAM data is read: the cached copy of its page when dirty,
+ * else address itself. The data must not cross a page.
+ */
+void WIDE *nvm_cache_map(void WIDE *address);
+
+/**
+ * Program the dirty pages atomically.
+ */
+void nvm_cache_commit(void);
+
+/**
+ * Drop the dirty pages, the NVRAM is left as of the last commit.
+ */
+void nvm_cache_discard(void);
+
+#define nvm_cache_dirty() (G_nvm_cache.count != 0)
+
+#endif // HAVE_NVM_CACHE
+
+#endif // OS_NVM_CACHE_H
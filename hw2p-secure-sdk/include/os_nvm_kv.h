@@ -0,0 +1,129 @@
+/*******************************************************************************
+*   Ledger Blue - Secure firmware
+*   (c) 2016, 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#ifndef OS_NVM_KV_H
+#define OS_NVM_KV_H
+
+#include "os.h"
+
+#ifdef HAVE_NVM_KV
+
+/**
+ * Wear leveled key-value store.
+ * Values are appended as records to a log in a reserved NVRAM region, an
+ * update programs the page following the previous record instead of always
+ * the same page. The region is made of two areas of NVM_KV_AREA_PAGES
+ * pages: the active one receives the appends, the other one is clean. When
+ * the active area runs out of pages, the live records are copied to the
+ * clean area (compaction) and the former one is zeroed, one page program per
+ * nvm_kv_step call, called on ticker events.
+ *
+ * Area: header page (magic 'K' 'V', generation, ~generation) | record pages
+ * Record: key | length | value | crc16 (LE) over key, length and value
+ * Each record has a page of its own, a zero key ends the log. A zero length
+ * record deletes the key.
+ *
+ * The index of the last record of each key is rebuilt by nvm_kv_init at
+ * boot. An area is only zeroed once all its live records have been copied,
+ * an interrupted compaction is resumed at the next boot. A page program
+ * interrupted by a power loss corrupts the whole page: as a page never holds
+ * a record besides the one being appended, and a header is only written to
+ * a clean area, only the record being appended is lost, the key then reads
+ * its previous value. With HAVE_NVM_CACHE, the records are written through
+ * the NVRAM cache and committed atomically with the reply to the command.
+ */
+
+#ifndef NVM_KV_AREA_PAGES
+#define NVM_KV_AREA_PAGES 16
+#endif // NVM_KV_AREA_PAGES
+
+// keys are 1..NVM_KV_MAX_KEYS
+#ifndef NVM_KV_MAX_KEYS
+#define NVM_KV_MAX_KEYS 4
+#endif // NVM_KV_MAX_KEYS
+
+#ifndef NVM_KV_MAX_VALUE
+#define NVM_KV_MAX_VALUE 12
+#endif // NVM_KV_MAX_VALUE
+
+#define NVM_KV_HEADER_SIZE 4
+// key, length, value, crc16
+#define NVM_KV_RECORD_SIZE(length) (2 + (length) + 2)
+#define NVM_KV_AREA_SIZE ((unsigned int)NVM_KV_AREA_PAGES * NVM_PAGE_SIZE)
+
+// the header page is followed by a record per page
+#define NVM_KV_AREA_RECORDS (NVM_KV_AREA_PAGES - 1)
+
+typedef char nvm_kv_record_must_fit_a_page
+    [(NVM_KV_RECORD_SIZE(NVM_KV_MAX_VALUE) <= NVM_PAGE_SIZE) ? 1 : -1];
+// each update made during a compaction advances it by one key: when it
+// completes, the area holds at most a copy and an update per key
+typedef char nvm_kv_area_too_small_for_the_keys
+    [(2 * NVM_KV_MAX_KEYS + 1 <= NVM_KV_AREA_RECORDS) ? 1 : -1];
+typedef char nvm_kv_keys_must_fit_a_byte[(NVM_KV_MAX_KEYS <= 255) ? 1 : -1];
+
+// no compaction, the spare area is clean
+#define NVM_KV_IDLE 0
+// live records of the former area are copied to the active one
+#define NVM_KV_COMPACTING 1
+// the spare area is zeroed
+#define NVM_KV_ERASING 2
+
+typedef struct nvm_kv_s {
+    // offset in the region of the last record of each key, 0 when not set
+    unsigned short index[NVM_KV_MAX_KEYS];
+    // append offset in the region, start of the first unused page
+    unsigned short head;
+    unsigned char active;
+    unsigned char generation;
+    unsigned char state;
+    // next key to copy, or next page to zero
+    unsigned char cursor;
+} nvm_kv_t;
+
+extern nvm_kv_t G_nvm_kv;
+
+/**
+ * Rebuild the index from the region, formatting it on first use.
+ */
+void nvm_kv_init(void);
+
+/**
+ * Copy the value of a key into value, at most size bytes. The value length
+ * is returned, 0 when the key is not set.
+ */
+unsigned int nvm_kv_get(unsigned int key, void *value, unsigned int size);
+
+/**
+ * Append a record for the key, compaction steps are run first when the
+ * active area is full. EXCEPTION_OVERFLOW is thrown for an invalid key or a
+ * value larger than NVM_KV_MAX_VALUE. A zero length deletes the key.
+ */
+void nvm_kv_set(unsigned int key, const void WIDE *value, unsigned int length);
+
+#define nvm_kv_delete(key) nvm_kv_set(key, NULL, 0)
+
+/**
+ * Background work, at most one page program: compaction started when the
+ * active area has a page left at most, record copy, or page zeroing.
+ * Return 0 when there was nothing to do.
+ */
+unsigned int nvm_kv_step(void);
+
+#endif // HAVE_NVM_KV
+
+#endif // OS_NVM_KV_H
@@ -170,6 +170,14 @@
          // LE)>
 #define SEPROXYHAL_TAG_SCREEN_DISPLAY_RAW_STATUS_START 0x00
 #define SEPROXYHAL_TAG_SCREEN_DISPLAY_RAW_STATUS_CONT 0x01
+#define SEPROXYHAL_TAG_SCREEN_DISPLAY_RAW_STATUS_STREAM_START                  \
+    0x02 // same as start, the display processed events of the transfer are
+         // replied with <credits(1byte)>, the number of bitmap chunks the MCU
+         // accepts before the next event
+#define SEPROXYHAL_TAG_SCREEN_DISPLAY_RAW_STREAM                               \
+    0x55 // <icon bitmap chunk>, consumes a credit of a streamed raw display,
+         // not replied (the last chunk of a window is sent as a
+         // SCREEN_DISPLAY_RAW_STATUS_CONT)
 #endif
 
 #endif
@@ -0,0 +1,251 @@
+"""
+*******************************************************************************
+*   Ledger SDK
+*   (c) 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+********************************************************************************
+
+I/O trace decoder.
+Renders a dump of the HAVE_IO_TRACE ring (see io_trace_dump in
+os_io_trace.h) as a timeline, then splits it per APDU in stages:
+  - reception:    first OUT transfer of the command -> command delivered
+  - processing:   command delivered -> reply handed to io_exchange
+  - transmission: reply handed to io_exchange -> last IN transfer
+Ticks come from the ticker events, the time resolution is the ticker
+interval. The SEPROXYHAL packets count of each stage is reported as well.
+Tag, state and media names are read from the SDK headers.
+"""
+
+from __future__ import print_function
+
+import argparse
+import binascii
+import os
+import re
+import struct
+import sys
+
+HEADER_SIZE = 8
+RECORD_SIZE = 8
+
+# keep in sync with os_io_trace.h
+POINT_SPI_RECV = 0x01
+POINT_SPI_SEND = 0x02
+POINT_EP_XFER = 0x03
+POINT_APDU_RX = 0x04
+POINT_APDU_TX = 0x05
+POINT_APDU_QUEUED = 0x06
+POINTS = {
+	POINT_SPI_RECV: "spi recv",
+	POINT_SPI_SEND: "spi send",
+	POINT_EP_XFER: "ep xfer",
+	POINT_APDU_RX: "apdu rx",
+	POINT_APDU_TX: "apdu tx",
+	POINT_APDU_QUEUED: "apdu queued",
+}
+
+XFER_SETUP = 0x01
+XFER_IN = 0x02
+XFER_OUT = 0x04
+XFERS = {XFER_SETUP: "setup", XFER_IN: "in", XFER_OUT: "out"}
+
+TAG_RE = re.compile(r"#define\s+SEPROXYHAL_TAG_(\w+)\s*(?:\\\s*\n)?\s*(0x[0-9a-fA-F]+)")
+ENUM_RE = r"typedef\s+enum\s*\{([^}]*)\}\s*%s\s*;"
+
+STAGES = ["reception", "processing", "transmission"]
+
+
+def parse_tags(filename):
+	defines = [(name, int(value, 16)) for name, value in TAG_RE.findall(open(filename).read())]
+	names = set(name for name, value in defines)
+	tags = {}
+	for name, value in defines:
+		# sub fields of a tag are prefixed with its name
+		if any(name != other and name.startswith(other + "_") for other in names):
+			continue
+		tags.setdefault(value, name.lower())
+	return tags
+
+
+def parse_enum(filename, typename):
+	m = re.search(ENUM_RE % typename, open(filename).read())
+	if not m:
+		return {}
+	values = {}
+	value = 0
+	for item in m.group(1).split(","):
+		item = re.sub(r"//.*", "", item).strip()
+		if not item:
+			continue
+		if "=" in item:
+			item, value = item.split("=")
+			item = item.strip()
+			value = int(value.strip(), 0)
+		values[value] = item.lower()
+		value += 1
+	# without the common prefix (IO_APDU_MEDIA_, APDU_)
+	prefix = os.path.commonprefix(list(values.values()))
+	prefix = prefix[:prefix.rfind("_") + 1]
+	return dict((k, v[len(prefix):]) for k, v in values.items())
+
+
+def parse_dump(data):
+	if len(data) < HEADER_SIZE:
+		raise ValueError("dump too short")
+	written, tick = struct.unpack(">II", data[:HEADER_SIZE])
+	records = []
+	for offset in range(HEADER_SIZE, len(data) - RECORD_SIZE + 1, RECORD_SIZE):
+		records.append(struct.unpack(">HHBBBB", data[offset:offset + RECORD_SIZE]))
+	# ticks are 16 bits, unwrapped backwards from the dump tick
+	full = tick
+	timeline = []
+	for low, length, point, tag, ep, state in reversed(records):
+		full -= (full - low) & 0xFFFF
+		timeline.append({"ms": full, "length": length, "point": point, "tag": tag, "ep": ep, "state": state})
+	timeline.reverse()
+	first = written - len(records)
+	for index, record in enumerate(timeline):
+		record["index"] = first + index
+	return written, tick, timeline
+
+
+def describe(record, tags, medias):
+	point = record["point"]
+	if point in (POINT_SPI_RECV, POINT_SPI_SEND):
+		return "%-22s ep/arg 0x%02x len %d" % (tags.get(record["tag"], "tag 0x%02x" % record["tag"]),
+			record["ep"], record["length"])
+	if point == POINT_EP_XFER:
+		return "%-22s ep 0x%02x len %d" % (XFERS.get(record["tag"], "0x%02x" % record["tag"]),
+			record["ep"], record["length"])
+	if point in (POINT_APDU_RX, POINT_APDU_QUEUED):
+		return "%-22s len %d" % (medias.get(record["tag"], "media %d" % record["tag"]), record["length"])
+	return "len %d" % record["length"]
+
+
+def print_timeline(timeline, tags, states, medias):
+	print("%8s %10s %6s  %-12s %-40s %s" % ("record", "ms", "+ms", "point", "detail", "state"))
+	previous = None
+	for record in timeline:
+		delta = record["ms"] - previous if previous is not None else 0
+		previous = record["ms"]
+		print("%8d %10d %+6d  %-12s %-40s %s" % (record["index"], record["ms"], delta,
+			POINTS.get(record["point"], "0x%02x" % record["point"]), describe(record, tags, medias),
+			states.get(record["state"], record["state"])))
+
+
+def is_packet(record):
+	return record["point"] in (POINT_SPI_RECV, POINT_SPI_SEND)
+
+
+def split_apdus(timeline):
+	"""
+	Stage boundaries (record indexes in the timeline) of each APDU. A
+	reception may start while the previous command is processed, when the
+	next command is queued.
+	"""
+	apdus = []
+	current = None
+	reception = None
+	for position, record in enumerate(timeline):
+		point = record["point"]
+		if point == POINT_EP_XFER and record["tag"] == XFER_OUT and reception is None:
+			reception = position
+		elif point == POINT_APDU_RX:
+			current = {"start": reception if reception is not None else position, "rx": position,
+				"tx": None, "end": None, "length": record["length"]}
+			apdus.append(current)
+			reception = None
+		elif point == POINT_APDU_TX and current is not None and current["tx"] is None:
+			current["tx"] = position
+		elif point == POINT_EP_XFER and record["tag"] == XFER_IN and current is not None and current["tx"] is not None:
+			current["end"] = position
+	return apdus
+
+
+def stage(timeline, begin, end):
+	if begin is None or end is None:
+		return None
+	packets = len([r for r in timeline[begin:end + 1] if is_packet(r)])
+	return timeline[end]["ms"] - timeline[begin]["ms"], packets
+
+
+def print_stages(timeline):
+	apdus = split_apdus(timeline)
+	if not apdus:
+		print("")
+		print("no complete apdu in the trace")
+		return
+	print("")
+	print("%8s %6s  %-20s %-20s %-20s" % ("record", "length", "reception ms/pkts", "processing ms/pkts",
+		"transmission ms/pkts"))
+	totals = dict((name, []) for name in STAGES)
+	for apdu in apdus:
+		stages = [stage(timeline, apdu["start"], apdu["rx"]), stage(timeline, apdu["rx"], apdu["tx"]),
+			stage(timeline, apdu["tx"], apdu["end"])]
+		cells = []
+		for name, value in zip(STAGES, stages):
+			if value is None:
+				cells.append("-")
+				continue
+			totals[name].append(value)
+			cells.append("%d/%d" % value)
+		print("%8d %6d  %-20s %-20s %-20s" % (timeline[apdu["rx"]]["index"], apdu["length"], cells[0], cells[1],
+			cells[2]))
+	print("")
+	print("%-14s %6s %8s %8s %8s %8s" % ("stage", "count", "min ms", "avg ms", "max ms", "avg pkts"))
+	for name in STAGES:
+		values = totals[name]
+		if not values:
+			continue
+		ms = [v[0] for v in values]
+		packets = [v[1] for v in values]
+		print("%-14s %6d %8d %8.1f %8d %8.1f" % (name, len(values), min(ms), float(sum(ms)) / len(ms), max(ms),
+			float(sum(packets)) / len(packets)))
+
+
+def main():
+	sdk = os.path.dirname(os.path.abspath(__file__))
+	parser = argparse.ArgumentParser(description="I/O trace ring decoder")
+	parser.add_argument("dump", nargs="?", help="binary dump (bench.py trace --output)")
+	parser.add_argument("--hex", help="dump as an hex string instead of a file")
+	parser.add_argument("--include", default=os.path.join(sdk, "include"), help="SDK headers directory")
+	args = parser.parse_args()
+
+	if args.hex:
+		data = binascii.unhexlify(args.hex.replace(" ", ""))
+	elif args.dump:
+		data = open(args.dump, "rb").read()
+	else:
+		parser.error("a dump file or --hex is required")
+
+	tags = parse_tags(os.path.join(args.include, "seproxyhal_protocol.h"))
+	states = parse_enum(os.path.join(args.include, "os_io_seproxyhal.h"), "io_apdu_state_e")
+	medias = parse_enum(os.path.join(args.include, "os.h"), "io_apdu_media_t")
+
+	try:
+		written, tick, timeline = parse_dump(bytearray(data))
+	except ValueError as e:
+		print("error: %s" % e)
+		return 1
+	print("%d records written, %d in the dump, dumped at %d ms" % (written, len(timeline), tick))
+	if written > len(timeline):
+		print("warning: the %d oldest records have been overwritten" % (written - len(timeline)))
+	print("")
+	print_timeline(timeline, tags, states, medias)
+	print_stages(timeline)
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
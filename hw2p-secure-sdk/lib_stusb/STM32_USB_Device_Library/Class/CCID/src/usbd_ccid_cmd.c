@@ -229,7 +229,9 @@ uint8_t  PC_to_RDR_XfrBlock(void)
                                   CHK_PARAM_ABORT |\
                                   CHK_ACTIVE_STATE );
   if (error != 0) 
+  {
     return error;
+  }
     
     if (Ccid_bulk_data.header.bulkout.dwLength > ABDATA_SIZE)
     { /* Check amount of Data Sent by Host is > than memory allocated ? */
@@ -897,8 +899,6 @@ void RDR_to_PC_Escape(uint8_t  errorCode)
   */
 void RDR_to_PC_DataRateAndClockFrequency(uint8_t  errorCode)
 {
-  uint16_t length = CCID_RESPONSE_HEADER_SIZE;
-  
   Ccid_bulk_data.header.bulkin.bMessageType = RDR_TO_PC_DATARATEANDCLOCKFREQUENCY; 
   Ccid_bulk_data.header.bulkin.bError = errorCode; 
   Ccid_bulk_data.header.bulkin.bSpecific=0;    /* Reserved for Future Use */
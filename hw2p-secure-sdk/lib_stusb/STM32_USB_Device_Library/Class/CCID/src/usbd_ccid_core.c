@@ -120,7 +120,6 @@ uint8_t  USBD_CCID_Setup (USBD_HandleTypeDef  *pdev, USBD_SetupReqTypedef *req)
 {
   uint8_t slot_nb;
   uint8_t seq_nb;
-  uint16_t len;
   
   switch (req->bmRequest & USB_REQ_TYPE_MASK)
   {
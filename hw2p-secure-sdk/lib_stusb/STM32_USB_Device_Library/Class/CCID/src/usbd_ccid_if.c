@@ -27,6 +27,7 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "usbd_ccid_if.h"
+#include "os_io_trace.h"
 
 #ifdef HAVE_USB_CLASS_CCID
 
@@ -61,7 +62,7 @@ void CCID_Init (USBD_HandleTypeDef  *pdev)
 {
   memset(&Ccid_BulkState, 0, sizeof(Ccid_BulkState));
   memset(&UsbIntMessageBuffer, 0, sizeof(UsbIntMessageBuffer));
-  memset(&PrevXferComplete_IntrIn, 0, sizeof(PrevXferComplete_IntrIn));
+  PrevXferComplete_IntrIn = 0;
   memset(&usb_ccid_param, 0, sizeof(usb_ccid_param));
   memset(&pUsbMessageBuffer, 0, sizeof(pUsbMessageBuffer));
   memset(&UsbMessageLength, 0, sizeof(UsbMessageLength));
@@ -483,6 +484,7 @@ uint8_t SC_ExecuteEscape (uint8_t* escapePtr, uint32_t escapeLen,
                           uint8_t* responseBuff,
                           uint16_t* responseLen) {
   io_seproxyhal_se_reset();
+  return SLOT_NO_ERROR;
 }
 uint8_t SC_SetClock (uint8_t bClockCommand) {
   return SLOT_NO_ERROR;
@@ -512,6 +514,19 @@ uint8_t SC_XferBlock (uint8_t* ptrBlock, uint32_t blockLen, uint16_t* expectedLe
     return SLOTERROR_BAD_LENTGH;
   }
   
+#ifdef HAVE_IO_APDU_QUEUE
+  // queue the command while the previous one is processed
+  if (G_io_apdu_media != IO_APDU_MEDIA_NONE || G_io_apdu_queue.count) {
+    uint8_t* buffer = io_apdu_queue_rx_buffer();
+    if (buffer == NULL) {
+      return SLOTERROR_CMD_SLOT_BUSY;
+    }
+    memmove(buffer, ptrBlock, blockLen);
+    io_apdu_queue_push(IO_APDU_MEDIA_USB_CCID, blockLen);
+    return SLOT_NO_ERROR;
+  }
+#endif // HAVE_IO_APDU_QUEUE
+
   // copy received apdu
   memmove(G_io_apdu_buffer, ptrBlock, blockLen);
   G_io_apdu_length = blockLen;
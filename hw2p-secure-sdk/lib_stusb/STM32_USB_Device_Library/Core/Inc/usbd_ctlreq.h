@@ -57,6 +57,32 @@
 /** @defgroup USBD_REQ_Exported_Types
   * @{
   */
+
+#ifdef HAVE_USB_DESC_CACHE
+#ifndef USBD_DESC_CACHE_SIZE
+#define USBD_DESC_CACHE_SIZE 10
+#endif // USBD_DESC_CACHE_SIZE
+
+/* descriptor type << 8 | string index for device requests, or interface
+   number for class descriptors requested to an interface */
+#define USBD_DESC_CACHE_KEY(type, index) (((type) << 8) | (index))
+
+typedef struct
+{
+  uint8_t  *data;
+  uint16_t key;
+  uint16_t length;
+} USBD_DescCacheEntryTypeDef;
+
+typedef struct
+{
+  uint8_t count;
+  USBD_DescCacheEntryTypeDef entries[USBD_DESC_CACHE_SIZE];
+} USBD_DescCacheTypeDef;
+
+extern USBD_DescCacheTypeDef USBD_DescCache;
+#endif // HAVE_USB_DESC_CACHE
+
 /**
   * @}
   */ 
@@ -91,6 +117,11 @@ void USBD_CtlError  (USBD_HandleTypeDef  *pdev, USBD_SetupReqTypedef *req);
 void USBD_ParseSetupRequest (USBD_SetupReqTypedef *req, uint8_t *pdata);
 
 void USBD_GetString         (uint8_t *desc, uint8_t *unicode, uint16_t *len);
+
+#ifdef HAVE_USB_DESC_CACHE
+void USBD_DescCacheInit     (USBD_HandleTypeDef  *pdev);
+void USBD_DescCacheAdd      (uint16_t key, uint8_t *data, uint16_t length);
+#endif // HAVE_USB_DESC_CACHE
 /**
   * @}
   */ 
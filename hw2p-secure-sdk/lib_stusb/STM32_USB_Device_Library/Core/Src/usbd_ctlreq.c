@@ -69,6 +69,9 @@
 /** @defgroup USBD_REQ_Private_Variables
   * @{
   */ 
+#ifdef HAVE_USB_DESC_CACHE
+USBD_DescCacheTypeDef USBD_DescCache;
+#endif // HAVE_USB_DESC_CACHE
 /**
   * @}
   */ 
@@ -100,6 +103,12 @@ void USBD_ClrFeature(USBD_HandleTypeDef *pdev ,
 
 uint8_t USBD_GetLen(uint8_t *buf);
 
+#ifdef HAVE_USB_DESC_CACHE
+static uint8_t USBD_DescCacheSend(USBD_HandleTypeDef *pdev, 
+                                  USBD_SetupReqTypedef *req,
+                                  uint16_t key);
+#endif // HAVE_USB_DESC_CACHE
+
 /**
   * @}
   */ 
@@ -178,6 +187,15 @@ USBD_StatusTypeDef  USBD_StdItfReq (USBD_HandleTypeDef *pdev , USBD_SetupReqType
     
     if (LOBYTE(req->wIndex) <= USBD_MAX_NUM_INTERFACES) 
     {
+#ifdef HAVE_USB_DESC_CACHE
+      // class descriptors (HID report...) without the class callback
+      if ((req->bmRequest & USB_REQ_TYPE_MASK) == USB_REQ_TYPE_STANDARD
+        && req->bRequest == USB_REQ_GET_DESCRIPTOR
+        && USBD_DescCacheSend(pdev, req, USBD_DESC_CACHE_KEY(req->wValue >> 8, LOBYTE(req->wIndex))))
+      {
+        break;
+      }
+#endif // HAVE_USB_DESC_CACHE
       ((Setup_t)PIC(pdev->pClass->Setup)) (pdev, req); 
       
       if((req->wLength == 0)&& (ret == USBD_OK))
@@ -335,6 +353,12 @@ void USBD_GetDescriptor(USBD_HandleTypeDef *pdev ,
   uint16_t len;
   uint8_t *pbuf;
   
+#ifdef HAVE_USB_DESC_CACHE
+  if (USBD_DescCacheSend(pdev, req, req->wValue))
+  {
+    return;
+  }
+#endif // HAVE_USB_DESC_CACHE
     
   switch (req->wValue >> 8)
   { 
@@ -700,6 +724,109 @@ void USBD_ParseSetupRequest(USBD_SetupReqTypedef *req, uint8_t *pdata)
 
 }
 
+#ifdef HAVE_USB_DESC_CACHE
+/**
+* @brief  USBD_DescCacheInit
+*         Fetch the device, string and configuration descriptors once, when
+*         the device is powered. GET_DESCRIPTOR requests are then served from
+*         the cache, without the PIC'd descriptor callbacks. The callbacks
+*         must return persistent buffers (not a shared USBD_GetString output).
+*         Class descriptors are added by the class with USBD_DescCacheAdd.
+* @param  pdev: device instance, descriptors and class registered
+* @retval None
+*/
+void USBD_DescCacheInit(USBD_HandleTypeDef *pdev)
+{
+  USBD_DescriptorsTypeDef *desc = pdev->pDesc;
+  uint16_t len;
+  uint8_t *pbuf;
+
+  USBD_DescCache.count = 0;
+
+#define USBD_DESC_CACHE_FETCH(type, index, callback)                          \
+  if (desc->callback != NULL)                                                 \
+  {                                                                           \
+    pbuf = ((GetDeviceDescriptor_t)PIC(desc->callback))(USBD_SPEED_FULL, &len);\
+    USBD_DescCacheAdd(USBD_DESC_CACHE_KEY(type, index), pbuf, len);           \
+  }
+
+  USBD_DESC_CACHE_FETCH(USB_DESC_TYPE_DEVICE, 0, GetDeviceDescriptor)
+  USBD_DESC_CACHE_FETCH(USB_DESC_TYPE_STRING, USBD_IDX_LANGID_STR, GetLangIDStrDescriptor)
+  USBD_DESC_CACHE_FETCH(USB_DESC_TYPE_STRING, USBD_IDX_MFC_STR, GetManufacturerStrDescriptor)
+  USBD_DESC_CACHE_FETCH(USB_DESC_TYPE_STRING, USBD_IDX_PRODUCT_STR, GetProductStrDescriptor)
+  USBD_DESC_CACHE_FETCH(USB_DESC_TYPE_STRING, USBD_IDX_SERIAL_STR, GetSerialStrDescriptor)
+  USBD_DESC_CACHE_FETCH(USB_DESC_TYPE_STRING, USBD_IDX_CONFIG_STR, GetConfigurationStrDescriptor)
+  USBD_DESC_CACHE_FETCH(USB_DESC_TYPE_STRING, USBD_IDX_INTERFACE_STR, GetInterfaceStrDescriptor)
+#undef USBD_DESC_CACHE_FETCH
+
+  // full speed device, the high speed configuration is never requested
+  if (pdev->pClass->GetFSConfigDescriptor != NULL)
+  {
+    pbuf = ((GetFSConfigDescriptor_t)PIC(pdev->pClass->GetFSConfigDescriptor))(&len);
+    USBD_DescCacheAdd(USBD_DESC_CACHE_KEY(USB_DESC_TYPE_CONFIGURATION, 0), pbuf, len);
+  }
+}
+
+/**
+* @brief  USBD_DescCacheAdd
+*         Add a ready to send descriptor to the cache, ignored when full
+* @param  key: USBD_DESC_CACHE_KEY of the descriptor
+* @param  data: descriptor, persistent
+* @param  length: descriptor length
+* @retval None
+*/
+void USBD_DescCacheAdd(uint16_t key, uint8_t *data, uint16_t length)
+{
+  USBD_DescCacheEntryTypeDef *entry;
+
+  if (USBD_DescCache.count == USBD_DESC_CACHE_SIZE || data == NULL)
+  {
+    return;
+  }
+  entry = &USBD_DescCache.entries[USBD_DescCache.count++];
+  entry->key = key;
+  entry->data = data;
+  entry->length = length;
+}
+
+/**
+* @brief  USBD_DescCacheSend
+*         Reply to a GET_DESCRIPTOR request from the cache
+* @param  pdev: device instance
+* @param  req: usb request
+* @param  key: USBD_DESC_CACHE_KEY of the requested descriptor
+* @retval 1 when replied, 0 when the descriptor is not cached
+*/
+static uint8_t USBD_DescCacheSend(USBD_HandleTypeDef *pdev, 
+                                  USBD_SetupReqTypedef *req,
+                                  uint16_t key)
+{
+  USBD_DescCacheEntryTypeDef *entry = USBD_DescCache.entries;
+  uint8_t count = USBD_DescCache.count;
+
+  // cached descriptors are the full speed ones
+  if (pdev->dev_speed == USBD_SPEED_HIGH)
+  {
+    return 0;
+  }
+  while (count--)
+  {
+    if (entry->key == key)
+    {
+      if ((entry->length != 0) && (req->wLength != 0))
+      {
+        USBD_CtlSendData (pdev, 
+                          entry->data,
+                          MIN(entry->length, req->wLength));
+      }
+      return 1;
+    }
+    entry++;
+  }
+  return 0;
+}
+#endif // HAVE_USB_DESC_CACHE
+
 /**
 * @brief  USBD_CtlError 
 *         Handle USB low level Error
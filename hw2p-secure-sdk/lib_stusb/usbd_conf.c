@@ -31,6 +31,7 @@
   ******************************************************************************
 */
 #include "os_io_seproxyhal.h"
+#include "os_io_trace.h"
 /* Includes ------------------------------------------------------------------*/
 #include "usbd_def.h"
 #include "usbd_core.h"
@@ -61,7 +61,30 @@ typedef signed short int16_t;
   */ 
 
 /*---------- -----------*/
+#ifdef HAVE_USB_REGISTRY
+/* interfaces and endpoints are declared by the application (see
+   usbd_registry.h), the interfaces and endpoints tables are sized after them */
+#include "usbd_registry_app.h"
+#define USBD_REGISTRY_ITF_ONE(number, class, subclass, protocol, class_desc, endpoints, ops) +1
+#define USBD_MAX_NUM_INTERFACES     (0 USBD_REGISTRY_APP_INTERFACES(USBD_REGISTRY_ITF_ONE))
+/* the size of an union of arrays is the size of the largest one: highest
+   registered endpoint number + 1 */
+#define USBD_REGISTRY_EP_ARRAY(number, address, type, size, interval) char ep_##address[((address) & 0x7F) + 1];
+#define USBD_REGISTRY_ITF_EP_ARRAYS(number, class, subclass, protocol, class_desc, endpoints, ops) endpoints(USBD_REGISTRY_EP_ARRAY, number)
+typedef union usbd_registry_endpoints_u {
+  char ep0[1];
+  USBD_REGISTRY_APP_INTERFACES(USBD_REGISTRY_ITF_EP_ARRAYS)
+} usbd_registry_endpoints_t;
+#ifdef IO_USB_MAX_ENDPOINTS
+#error IO_USB_MAX_ENDPOINTS is computed from the registry when HAVE_USB_REGISTRY is defined
+#endif // IO_USB_MAX_ENDPOINTS
+#define IO_USB_MAX_ENDPOINTS     sizeof(usbd_registry_endpoints_t)
+#else // HAVE_USB_REGISTRY
+/* composite devices (several interfaces) override it */
+#ifndef USBD_MAX_NUM_INTERFACES
 #define USBD_MAX_NUM_INTERFACES     1
+#endif // USBD_MAX_NUM_INTERFACES
+#endif // HAVE_USB_REGISTRY
 /*---------- -----------*/
 #define USBD_MAX_NUM_CONFIGURATION     1
 /*---------- -----------*/
@@ -0,0 +1,210 @@
+/*******************************************************************************
+*   Ledger Nano S - Secure firmware
+*   (c) 2016, 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#include "os.h"
+#include "os_io_seproxyhal.h"
+
+#ifdef HAVE_USB_REGISTRY
+
+#include "usbd_def.h"
+#include "usbd_core.h"
+#include "usbd_ctlreq.h"
+#include "usbd_ioreq.h"
+#include "usbd_registry.h"
+
+typedef struct usbd_registry_endpoint_s {
+  uint8_t interface;
+  uint8_t address;
+  uint8_t type;
+  uint16_t size;
+} usbd_registry_endpoint_t;
+
+// interfaces numbers are 0..count-1, each used once
+#define USBD_REGISTRY_ITF_BIT(number, class, subclass, protocol, class_desc, endpoints, ops) +(1u << (number))
+typedef char usbd_registry_interfaces_must_be_contiguous
+  [((0 USBD_REGISTRY_APP_INTERFACES(USBD_REGISTRY_ITF_BIT)) == ((1u << USBD_MAX_NUM_INTERFACES) - 1)) ? 1 : -1];
+
+// an endpoint address is registered once, IN endpoints in the upper half
+#define USBD_REGISTRY_EP_BIT(number, address, type, size, interval) (1u << (((address) & 0x7F) + (((address) & 0x80) ? 16 : 0)))
+#define USBD_REGISTRY_EP_SUM(number, address, type, size, interval) +USBD_REGISTRY_EP_BIT(number, address, type, size, interval)
+#define USBD_REGISTRY_EP_OR(number, address, type, size, interval) |USBD_REGISTRY_EP_BIT(number, address, type, size, interval)
+#define USBD_REGISTRY_ITF_EP_SUM(number, class, subclass, protocol, class_desc, endpoints, ops) endpoints(USBD_REGISTRY_EP_SUM, number)
+#define USBD_REGISTRY_ITF_EP_OR(number, class, subclass, protocol, class_desc, endpoints, ops) endpoints(USBD_REGISTRY_EP_OR, number)
+typedef char usbd_registry_endpoints_must_be_disjoint
+  [((0 USBD_REGISTRY_APP_INTERFACES(USBD_REGISTRY_ITF_EP_SUM)) == (0 USBD_REGISTRY_APP_INTERFACES(USBD_REGISTRY_ITF_EP_OR))) ? 1 : -1];
+
+#define USBD_REGISTRY_OPS_ENTRY(number, class, subclass, protocol, class_desc, endpoints, ops) [(number)] = &ops,
+static const usbd_interface_ops_t* const USBD_Registry_Ops[USBD_MAX_NUM_INTERFACES] = {
+  USBD_REGISTRY_APP_INTERFACES(USBD_REGISTRY_OPS_ENTRY)
+};
+
+#define USBD_REGISTRY_EP_ENTRY(number, address, type, size, interval) {(number), (address), (type), (size)},
+#define USBD_REGISTRY_ITF_EP_ENTRIES(number, class, subclass, protocol, class_desc, endpoints, ops) endpoints(USBD_REGISTRY_EP_ENTRY, number)
+static const usbd_registry_endpoint_t USBD_Registry_Endpoints[] = {
+  USBD_REGISTRY_APP_INTERFACES(USBD_REGISTRY_ITF_EP_ENTRIES)
+};
+
+// owning interface number + 1 of each endpoint (0 when not registered),
+// indexed by direction (0: OUT, 1: IN) and endpoint number
+#define USBD_REGISTRY_EP_OWNER(number, address, type, size, interval) [((address) & 0x80) ? 1 : 0][(address) & 0x7F] = (number) + 1,
+#define USBD_REGISTRY_ITF_EP_OWNERS(number, class, subclass, protocol, class_desc, endpoints, ops) endpoints(USBD_REGISTRY_EP_OWNER, number)
+static const uint8_t USBD_Registry_EndpointOwner[2][IO_USB_MAX_ENDPOINTS] = {
+  USBD_REGISTRY_APP_INTERFACES(USBD_REGISTRY_ITF_EP_OWNERS)
+};
+
+/* USB Standard Device Qualifier Descriptor */
+static __ALIGN_BEGIN const uint8_t USBD_Registry_DeviceQualifierDesc[] __ALIGN_END = {
+  USB_LEN_DEV_QUALIFIER_DESC,
+  USB_DESC_TYPE_DEVICE_QUALIFIER,
+  0x00,
+  0x02,
+  0x00,
+  0x00,
+  0x00,
+  0x40,
+  0x01,
+  0x00,
+};
+
+static const usbd_interface_ops_t* USBD_Registry_GetOps(unsigned int interface) {
+  if (interface >= USBD_MAX_NUM_INTERFACES) {
+    return NULL;
+  }
+  return (const usbd_interface_ops_t*)PIC(USBD_Registry_Ops[interface]);
+}
+
+// ops of the interface owning an endpoint, NULL if not registered
+static const usbd_interface_ops_t* USBD_Registry_GetEndpointOps(uint8_t ep_addr) {
+  uint8_t owner;
+  if ((ep_addr & 0x7F) >= IO_USB_MAX_ENDPOINTS) {
+    return NULL;
+  }
+  owner = USBD_Registry_EndpointOwner[(ep_addr & 0x80) ? 1 : 0][ep_addr & 0x7F];
+  if (owner == 0) {
+    return NULL;
+  }
+  return USBD_Registry_GetOps(owner - 1);
+}
+
+static uint8_t USBD_Registry_Init(USBD_HandleTypeDef* pdev, uint8_t cfgidx) {
+  unsigned int i;
+  const usbd_interface_ops_t* ops;
+
+  for (i = 0; i < ARRAYLEN(USBD_Registry_Endpoints); i++) {
+    const usbd_registry_endpoint_t* ep = &USBD_Registry_Endpoints[i];
+    if (USBD_Registry_GetOps(ep->interface)->init != NULL) {
+      continue;
+    }
+    USBD_LL_OpenEP(pdev, ep->address, ep->type, ep->size);
+    if ((ep->address & 0x80) == 0) {
+      USBD_LL_PrepareReceive(pdev, ep->address, ep->size);
+    }
+  }
+
+  for (i = 0; i < USBD_MAX_NUM_INTERFACES; i++) {
+    ops = USBD_Registry_GetOps(i);
+    if (ops->init != NULL) {
+      ((Init_t)PIC(ops->init))(pdev, cfgidx);
+    }
+  }
+  return USBD_OK;
+}
+
+static uint8_t USBD_Registry_DeInit(USBD_HandleTypeDef* pdev, uint8_t cfgidx) {
+  unsigned int i;
+  const usbd_interface_ops_t* ops;
+
+  for (i = 0; i < ARRAYLEN(USBD_Registry_Endpoints); i++) {
+    const usbd_registry_endpoint_t* ep = &USBD_Registry_Endpoints[i];
+    if (USBD_Registry_GetOps(ep->interface)->deinit == NULL) {
+      USBD_LL_CloseEP(pdev, ep->address);
+    }
+  }
+
+  for (i = 0; i < USBD_MAX_NUM_INTERFACES; i++) {
+    ops = USBD_Registry_GetOps(i);
+    if (ops->deinit != NULL) {
+      ((DeInit_t)PIC(ops->deinit))(pdev, cfgidx);
+    }
+  }
+  return USBD_OK;
+}
+
+static uint8_t USBD_Registry_Setup(USBD_HandleTypeDef* pdev, USBD_SetupReqTypedef* req) {
+  const usbd_interface_ops_t* ops = NULL;
+
+  switch (req->bmRequest & USB_REQ_RECIPIENT_MASK) {
+    case USB_REQ_RECIPIENT_INTERFACE:
+      ops = USBD_Registry_GetOps(LOBYTE(req->wIndex));
+      break;
+    case USB_REQ_RECIPIENT_ENDPOINT:
+      ops = USBD_Registry_GetEndpointOps(LOBYTE(req->wIndex));
+      break;
+  }
+
+  if (ops == NULL || ops->setup == NULL) {
+    USBD_CtlError(pdev, req);
+    return USBD_FAIL;
+  }
+  return ((Setup_t)PIC(ops->setup))(pdev, req);
+}
+
+static uint8_t USBD_Registry_DataIn(USBD_HandleTypeDef* pdev, uint8_t epnum) {
+  const usbd_interface_ops_t* ops = USBD_Registry_GetEndpointOps(epnum | 0x80);
+  if (ops == NULL || ops->data_in == NULL) {
+    return USBD_OK;
+  }
+  return ((DataIn_t)PIC(ops->data_in))(pdev, epnum);
+}
+
+static uint8_t USBD_Registry_DataOut(USBD_HandleTypeDef* pdev, uint8_t epnum, uint8_t* buffer) {
+  const usbd_interface_ops_t* ops = USBD_Registry_GetEndpointOps(epnum & 0x7F);
+  if (ops == NULL || ops->data_out == NULL) {
+    return USBD_OK;
+  }
+  return ((DataOut_t)PIC(ops->data_out))(pdev, epnum, buffer);
+}
+
+static uint8_t* USBD_Registry_GetCfgDesc(uint16_t* length) {
+  // wTotalLength
+  *length = USBD_Registry_CfgDesc[2] | (USBD_Registry_CfgDesc[3] << 8);
+  return (uint8_t*)USBD_Registry_CfgDesc;
+}
+
+static uint8_t* USBD_Registry_GetDeviceQualifierDesc(uint16_t* length) {
+  *length = sizeof(USBD_Registry_DeviceQualifierDesc);
+  return (uint8_t*)USBD_Registry_DeviceQualifierDesc;
+}
+
+const USBD_ClassTypeDef USBD_Registry = {
+  USBD_Registry_Init,
+  USBD_Registry_DeInit,
+  USBD_Registry_Setup,
+  NULL, /*EP0_TxSent*/
+  NULL, /*EP0_RxReady*/
+  USBD_Registry_DataIn,
+  USBD_Registry_DataOut,
+  NULL, /*SOF */
+  NULL,
+  NULL,
+  USBD_Registry_GetCfgDesc,
+  USBD_Registry_GetCfgDesc,
+  USBD_Registry_GetCfgDesc,
+  USBD_Registry_GetDeviceQualifierDesc,
+};
+
+#endif // HAVE_USB_REGISTRY
@@ -0,0 +1,115 @@
+/*******************************************************************************
+*   Ledger Nano S - Secure firmware
+*   (c) 2016, 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#ifndef USBD_REGISTRY_H
+#define USBD_REGISTRY_H
+
+#ifdef HAVE_USB_REGISTRY
+
+#include "usbd_def.h"
+#include "usbd_registry_app.h"
+
+/**
+ * USB interfaces and endpoints registry.
+ * The application provides usbd_registry_app.h, defining
+ * USBD_REGISTRY_APP_INTERFACES(X) as a list of
+ * X(number, class, subclass, protocol, class_desc, endpoints, ops):
+ *  - number: interface number, interfaces are numbered from 0
+ *  - class_desc: functional descriptor following the interface descriptor,
+ *    bytes each preceded by a comma (USBD_REGISTRY_HID_DESC, or
+ *    USBD_REGISTRY_NO_DESC)
+ *  - endpoints: list of E(number, address, type, size, interval), invoked as
+ *    endpoints(E, number)
+ *  - ops: usbd_interface_ops_t of the interface transport
+ *
+ * The application defines USBD_Registry_CfgDesc with USBD_REGISTRY_CFGDESC,
+ * and registers the USBD_Registry class. The interface and endpoint tables
+ * (USBD_MAX_NUM_INTERFACES, IO_USB_MAX_ENDPOINTS) are sized after the list,
+ * see usbd_conf.h. Requests and transfers are dispatched to the interface
+ * ops through tables indexed by the interface or endpoint number.
+ */
+
+/**
+ * Transport of an interface. When init (resp. deinit) is NULL, the interface
+ * endpoints are opened and the OUT ones prepared to receive (resp. closed)
+ * by the registry, else the callback is in charge of them (ST classes).
+ * Unused callbacks are NULL.
+ */
+typedef struct usbd_interface_ops_s {
+    Init_t init;
+    DeInit_t deinit;
+    // interface and endpoint recipient requests
+    Setup_t setup;
+    DataIn_t data_in;
+    DataOut_t data_out;
+} usbd_interface_ops_t;
+
+#define USBD_REGISTRY_OPS_DECLARE(number, class, subclass, protocol,          \
+                                  class_desc, endpoints, ops)                  \
+    extern const usbd_interface_ops_t ops;
+USBD_REGISTRY_APP_INTERFACES(USBD_REGISTRY_OPS_DECLARE)
+
+// functional descriptors
+#define USBD_REGISTRY_NO_DESC
+#define USBD_REGISTRY_HID_DESC(report_length)                                  \
+    , 0x09,                      /* bLength: HID Descriptor size */            \
+        0x21,                    /* bDescriptorType: HID */                    \
+        0x11, 0x01,              /* bcdHID: HID Class Spec release number */   \
+        0x00,                    /* bCountryCode */                            \
+        0x01,                    /* bNumDescriptors */                         \
+        0x22,                    /* bDescriptorType: report */                 \
+        LOBYTE(report_length),   /* wItemLength */                             \
+        HIBYTE(report_length)
+
+#define USBD_REGISTRY_EP_DESC(number, address, type, size, interval)           \
+    , 0x07, USB_DESC_TYPE_ENDPOINT, (address), (type), LOBYTE(size),          \
+        HIBYTE(size), (interval)
+#define USBD_REGISTRY_EP_ONE(number, address, type, size, interval) +1
+
+#define USBD_REGISTRY_ITF_DESC(number, class, subclass, protocol, class_desc,  \
+                               endpoints, ops)                                 \
+    , 0x09, USB_DESC_TYPE_INTERFACE, (number), 0x00,                           \
+        (0 endpoints(USBD_REGISTRY_EP_ONE, number)), (class), (subclass),      \
+        (protocol), USBD_IDX_PRODUCT_STR class_desc                            \
+            endpoints(USBD_REGISTRY_EP_DESC, number)
+
+// interfaces descriptors, the leading 0 absorbs the first comma
+#define USBD_REGISTRY_ITFS_DESC                                                \
+    0 USBD_REGISTRY_APP_INTERFACES(USBD_REGISTRY_ITF_DESC)
+#define USBD_REGISTRY_CFGDESC_LENGTH                                           \
+    (0x09 + sizeof((const uint8_t[]){USBD_REGISTRY_ITFS_DESC}) - 1)
+
+/**
+ * Initializer of the configuration descriptor, wTotalLength, bNumInterfaces
+ * and each bNumEndpoints are computed from the registry.
+ */
+#define USBD_REGISTRY_CFGDESC(attributes, max_power)                           \
+    {                                                                          \
+        0x09, USB_DESC_TYPE_CONFIGURATION,                                     \
+            LOBYTE(USBD_REGISTRY_CFGDESC_LENGTH),                              \
+            HIBYTE(USBD_REGISTRY_CFGDESC_LENGTH), USBD_MAX_NUM_INTERFACES,     \
+            0x01, USBD_IDX_PRODUCT_STR, (attributes),                          \
+            (max_power) USBD_REGISTRY_APP_INTERFACES(USBD_REGISTRY_ITF_DESC)   \
+    }
+
+extern const uint8_t USBD_Registry_CfgDesc[];
+
+extern const USBD_ClassTypeDef USBD_Registry;
+
+#endif // HAVE_USB_REGISTRY
+
+#endif // USBD_REGISTRY_H
@@ -579,8 +579,11 @@ uint8_t  USBD_HID_DataOut_impl (USBD_HandleTypeDef *pdev,
     // prepare receiving the next chunk (masked time)
     USBD_LL_PrepareReceive(pdev, HID_EPOUT_ADDR , HID_EPOUT_SIZE);
 
+#ifndef HAVE_IO_APDU_QUEUE
     // avoid troubles when an apdu has not been replied yet
-    if (G_io_apdu_media == IO_APDU_MEDIA_NONE) {      
+    if (G_io_apdu_media == IO_APDU_MEDIA_NONE)
+#endif // HAVE_IO_APDU_QUEUE
+    {
       // add to the hid transport
       switch(io_usb_hid_receive(io_usb_send_apdu_data, buffer, io_seproxyhal_get_ep_rx_size(HID_EPOUT_ADDR))) {
         default:
@@ -0,0 +1,266 @@
+"""
+*******************************************************************************
+*   Ledger SDK
+*   (c) 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+********************************************************************************
+
+Post link analysis of an application (make linkmap, make link-order).
+Symbols are taken from the ELF symbol table (bin/app.elf), attributed to a
+module from the linker map (debug/app.map) and to a subsystem from their name
+or module. The call graph is taken from the disassembly (debug/app.asm), a
+function whose address appears in a literal (callbacks, element tables) is
+considered reachable.
+  - size per subsystem
+  - functions linked in but not reachable from the roots
+  - symbols of the subsystems the device doesn't use (--unused, ux on a
+    screenless device), with the call path keeping them in the image
+  - ordering file placing the functions reached from the hot roots together
+    (--order, included by script.ld)
+"""
+
+from __future__ import print_function
+
+import argparse
+import bisect
+import re
+import struct
+import sys
+
+import mapsize
+import stack_usage
+
+WORD_RE = re.compile(r"\.word\s+0x([0-9a-fA-F]+)")
+
+STT_OBJECT = 1
+STT_FUNC = 2
+SHT_SYMTAB = 2
+
+# first match wins, (name, symbol regex, module regex)
+SUBSYSTEMS = [
+	("ux", r"^(ux_|UX_|bagl_|screen_|C_|G_ux|icon_bitmap_reader_|"
+		r"io_seproxyhal_(display|touch|button|backlight|init_ux|init_button))", None),
+	("u2f", r"^(u2f|U2F)", r"u2f_"),
+	("usb", r"^(USBD_|USB_|usbd_|io_usb_|HID_)", r"(lib_stusb|usbd_)"),
+	("crypto", r"^cx_", None),
+	("seproxyhal", r"^(io_seproxyhal_|G_io_seproxyhal)", r"os_io_seproxyhal"),
+	("syscalls", None, r"syscalls\.o$"),
+	("os", r"^(os_|G_io_|G_try)", r"^sdk/"),
+	("libc", None, r"\.a\("),
+]
+
+
+def read_symbols(filename):
+	"""(name, address, size, type) of the sized functions and objects"""
+	data = open(filename, "rb").read()
+	if data[:4] != b"\x7fELF" or data[4] != 1:
+		raise ValueError("%s: not an ELF32 file" % filename)
+	shoff, = struct.unpack_from("<I", data, 0x20)
+	shentsize, shnum = struct.unpack_from("<HH", data, 0x2E)
+	sections = [struct.unpack_from("<IIIIIIIIII", data, shoff + i * shentsize) for i in range(shnum)]
+	symbols = []
+	for section in sections:
+		if section[1] != SHT_SYMTAB:
+			continue
+		strtab = sections[section[6]]
+		for offset in range(section[4], section[4] + section[5], 16):
+			name, value, size, info, other, shndx = struct.unpack_from("<IIIBBH", data, offset)
+			kind = info & 0xF
+			if kind not in (STT_FUNC, STT_OBJECT) or size == 0 or shndx == 0:
+				continue
+			start = strtab[4] + name
+			name = data[start:data.index(b"\0", start)].decode()
+			# thumb bit
+			if kind == STT_FUNC:
+				value &= ~1
+			symbols.append((name, value, size, kind))
+	return symbols
+
+
+def read_literals(filename):
+	"""values of the literal words of the disassembly"""
+	literals = set()
+	for line in open(filename):
+		m = WORD_RE.search(line)
+		if m:
+			literals.add(int(m.group(1), 16) & ~1)
+	return literals
+
+
+class ModuleIndex:
+	def __init__(self, sections):
+		self.sections = sorted((address, size, mapsize.module_name(module)) for _, address, size, module in sections if size)
+		self.starts = [s[0] for s in self.sections]
+
+	def module(self, address):
+		i = bisect.bisect_right(self.starts, address) - 1
+		if i >= 0 and address < self.sections[i][0] + self.sections[i][1]:
+			return self.sections[i][2]
+		return "?"
+
+
+def subsystem_of(name, module, rules):
+	for subsystem, symbol_re, module_re in rules:
+		if symbol_re and re.search(symbol_re, name):
+			return subsystem
+		if module_re and re.search(module_re, module):
+			return subsystem
+	return "app"
+
+
+def reach(calls, roots):
+	"""parent of each function reached from the roots, roots being their own parent"""
+	parents = dict((root, root) for root in roots if root in calls)
+	pending = sorted(parents)
+	while pending:
+		caller = pending.pop()
+		for callee in sorted(calls.get(caller, ())):
+			if callee not in parents:
+				parents[callee] = caller
+				pending.append(callee)
+	return parents
+
+
+def path_to(parents, name):
+	path = [name]
+	while parents[path[-1]] != path[-1]:
+		path.append(parents[path[-1]])
+	return list(reversed(path))
+
+
+def print_table(title, header, rows):
+	print("")
+	print(title)
+	print("  " + header)
+	for row in rows:
+		print("  " + row)
+
+
+def hot_order(calls, roots, functions):
+	"""functions reached from the hot roots, depth first in call order"""
+	order = []
+	seen = set()
+
+	def visit(name):
+		if name in seen or name not in functions:
+			return
+		seen.add(name)
+		order.append(name)
+		# callees in the current layout order, keeps the result stable
+		for callee in sorted(calls.get(name, ()), key=lambda f: functions.get(f, (0, 0))[0]):
+			visit(callee)
+
+	for root in roots:
+		visit(root)
+	return order
+
+
+def write_order(filename, order, functions, excluded):
+	with open(filename, "w") as f:
+		f.write("/* generated by linkmap.py --order, functions on the hot path placed together */\n")
+		for name in order:
+			if name not in excluded:
+				f.write("*(.text.%s)\n" % name)
+
+
+def main():
+	parser = argparse.ArgumentParser(description="post link analysis")
+	parser.add_argument("--map", default="debug/app.map", help="linker map file")
+	parser.add_argument("--elf", default="bin/app.elf")
+	parser.add_argument("--asm", default="debug/app.asm", help="objdump -d output")
+	parser.add_argument("--root", action="append", help="entry points, default main")
+	parser.add_argument("--unused", action="append", default=[], help="subsystem the device doesn't use (ux)")
+	parser.add_argument("--subsystem", action="append", default=[],
+		help="name=regex, extra subsystem matching symbol names, checked first")
+	parser.add_argument("--hot", action="append", default=[], help="hot path root")
+	parser.add_argument("--order", help="ordering file to write, from the hot roots")
+	parser.add_argument("--top", type=int, default=20)
+	args = parser.parse_args()
+
+	rules = [(s.split("=", 1)[0], s.split("=", 1)[1], None) for s in args.subsystem] + SUBSYSTEMS
+	regions, sections = mapsize.parse_map(args.map)
+	modules = ModuleIndex(sections)
+	symbols = read_symbols(args.elf)
+	calls, _, _ = stack_usage.parse_asm(args.asm)
+	literals = read_literals(args.asm)
+
+	flash = regions.get("FLASH", (0, 0))
+	sram = regions.get("SRAM", (0, 0))
+	functions = {}
+	entries = []
+	for name, address, size, kind in symbols:
+		if flash[0] <= address < flash[0] + flash[1]:
+			region = "flash"
+		elif sram[0] <= address < sram[0] + sram[1]:
+			region = "ram"
+		else:
+			continue
+		module = modules.module(address)
+		entries.append((name, address, size, kind, region, module, subsystem_of(name, module, rules)))
+		if kind == STT_FUNC:
+			functions[name] = (address, size)
+
+	# size per subsystem
+	totals = {}
+	for name, address, size, kind, region, module, subsystem in entries:
+		total = totals.setdefault(subsystem, {"flash": 0, "ram": 0, "functions": 0})
+		total[region] += size
+		total["functions"] += kind == STT_FUNC
+	rows = ["%-12s %8d %8d %10d" % (s, t["flash"], t["ram"], t["functions"])
+		for s, t in sorted(totals.items(), key=lambda i: -i[1]["flash"])]
+	rows.append("%-12s %8d %8d %10d" % ("total", sum(t["flash"] for t in totals.values()),
+		sum(t["ram"] for t in totals.values()), sum(t["functions"] for t in totals.values())))
+	print_table("subsystems (bytes)", "%-12s %8s %8s %10s" % ("subsystem", "flash", "ram", "functions"), rows)
+
+	# reachability, callbacks are reached through their address
+	roots = args.root or ["main"]
+	address_taken = sorted(name for name, (address, _) in functions.items() if address in literals)
+	parents = reach(calls, roots + address_taken)
+	unreachable = sorted((e for e in entries if e[3] == STT_FUNC and e[0] not in parents), key=lambda e: -e[2])
+	rows = ["%-40s %8d  %s" % (e[0], e[2], e[6]) for e in unreachable[:args.top]]
+	print_table("unreachable functions: %d, %d bytes" % (len(unreachable), sum(e[2] for e in unreachable)),
+		"%-40s %8s  %s" % ("function", "size", "subsystem"), rows)
+
+	# code of unused subsystems, and what keeps it
+	for unused in args.unused:
+		kept = sorted((e for e in entries if e[6] == unused), key=lambda e: -e[2])
+		rows = []
+		for e in kept[:args.top]:
+			if e[0] in parents:
+				why = " > ".join(path_to(parents, e[0]))
+			elif e[3] == STT_FUNC:
+				why = "unreachable"
+			else:
+				why = "data"
+			rows.append("%-32s %8d  %s" % (e[0], e[2], why))
+		print_table("unused subsystem %s: %d symbols, %d bytes" % (unused, len(kept), sum(e[2] for e in kept)),
+			"%-32s %8s  %s" % ("symbol", "size", "kept by"), rows)
+
+	if args.hot:
+		order = hot_order(calls, args.hot, functions)
+		size = sum(functions[f][1] for f in order)
+		span = 0
+		if order:
+			span = max(functions[f][0] + functions[f][1] for f in order) - min(functions[f][0] for f in order)
+		print("")
+		print("hot path: %d functions, %d bytes, spread over %d bytes in the current layout" % (len(order), size, span))
+		if args.order:
+			# main is placed first by the .boot section
+			write_order(args.order, order, functions, set(roots))
+			print("ordering file %s written" % args.order)
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
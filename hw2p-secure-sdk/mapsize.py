@@ -0,0 +1,241 @@
+"""
+*******************************************************************************
+*   Ledger SDK
+*   (c) 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+********************************************************************************
+
+Memory budget of an application, from the linker map (debug/app.map).
+Input sections are attributed to a symbol (thanks to -ffunction-sections and
+-fdata-sections) and to a module (object file), then accounted in:
+  - flash: code and constants
+  - nvram: N_ variables, placed in flash between _etext and _envram
+  - ram:   variables in SRAM, the stack (STACK_SIZE) being reserved on top
+Exits in error when a region overflows, or when the usage grows over the
+baseline (see --baseline and --update-baseline).
+"""
+
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import re
+import sys
+
+REGION_RE = re.compile(r"^(\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)")
+# ' .bss.name 0xaddr 0xsize module', possibly split on two lines when the
+# section name is long
+SECTION_RE = re.compile(r"^ (\.\S+|COMMON)(?:\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(.+))?$")
+SECTION_CONT_RE = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(.+)$")
+STACK_SIZE_RE = re.compile(r"^\s*STACK_SIZE\s*=\s*(\d+)\s*;")
+
+KINDS = ["flash", "nvram", "ram"]
+SECTION_PREFIXES = [".text.", ".rodata.", ".bss.", ".data.", ".sbss.", ".sdata."]
+
+
+def parse_map(filename):
+	regions = {}
+	sections = []
+	state = None
+	pending = None
+	for line in open(filename):
+		line = line.rstrip("\n")
+		if line.startswith("Memory Configuration"):
+			state = "regions"
+			continue
+		if line.startswith("Linker script and memory map"):
+			state = "map"
+			continue
+		if state == "regions":
+			m = REGION_RE.match(line)
+			if m and m.group(1) != "*default*" and m.group(1) != "Name":
+				regions[m.group(1)] = (int(m.group(2), 16), int(m.group(3), 16))
+			continue
+		if state != "map":
+			continue
+		if pending:
+			m = SECTION_CONT_RE.match(line)
+			if m:
+				sections.append((pending, int(m.group(1), 16), int(m.group(2), 16), m.group(3).strip()))
+			pending = None
+			continue
+		m = SECTION_RE.match(line)
+		if not m:
+			continue
+		if m.group(2) is None:
+			pending = m.group(1)
+			continue
+		sections.append((m.group(1), int(m.group(2), 16), int(m.group(3), 16), m.group(4).strip()))
+	return regions, sections
+
+
+def parse_stack_size(filename):
+	for line in open(filename):
+		m = STACK_SIZE_RE.match(line)
+		if m:
+			return int(m.group(1))
+	return 0
+
+
+def symbol_name(section):
+	for prefix in SECTION_PREFIXES:
+		if section.startswith(prefix):
+			return section[len(prefix):]
+	return section
+
+
+def module_name(module):
+	# keep archive members as lib.a(member.o)
+	if "(" in module:
+		return os.path.basename(module)
+	# objects keep their source path (obj/sdk/src/x.o, obj/src/x.o), so that
+	# sources with the same name are not merged
+	if module.startswith("obj/"):
+		return module[len("obj/"):]
+	return os.path.basename(module)
+
+
+def region_of(regions, address):
+	for name, (origin, length) in regions.items():
+		if origin <= address < origin + length:
+			return name
+	return None
+
+
+def account(regions, sections):
+	usage = {"symbols": {}, "modules": {}, "totals": dict((k, 0) for k in KINDS)}
+	for section, address, size, module in sections:
+		if size == 0:
+			continue
+		region = region_of(regions, address)
+		if region == "FLASH":
+			name = symbol_name(section)
+			kind = "nvram" if name.startswith("N_") else "flash"
+		elif region == "SRAM":
+			kind = "ram"
+		else:
+			# DISCARD and debug sections
+			continue
+		symbol = symbol_name(section)
+		module = module_name(module)
+		key = "%s:%s" % (kind, symbol)
+		usage["symbols"][key] = usage["symbols"].get(key, 0) + size
+		entry = usage["modules"].setdefault(module, dict((k, 0) for k in KINDS))
+		entry[kind] += size
+		usage["totals"][kind] += size
+	return usage
+
+
+def print_table(title, rows, header):
+	print("")
+	print(title)
+	print("  " + header)
+	for row in rows:
+		print("  " + row)
+
+
+def report(usage, regions, stack_size, top, baseline):
+	flash_limit = regions.get("FLASH", (0, 0))[1]
+	ram_limit = regions.get("SRAM", (0, 0))[1] - stack_size
+	totals = usage["totals"]
+	failures = []
+
+	rows = []
+	for kind, used, limit in [
+			("flash+nvram", totals["flash"] + totals["nvram"], flash_limit),
+			("ram", totals["ram"], ram_limit)]:
+		rows.append("%-12s %8d %8d %8d %5.1f%%" % (kind, used, limit, limit - used,
+			100.0 * used / limit if limit else 0))
+		if limit and used > limit:
+			failures.append("%s overflow: %d > %d bytes" % (kind, used, limit))
+	print_table("regions (stack %d bytes reserved in ram)" % stack_size, rows,
+		"%-12s %8s %8s %8s %6s" % ("region", "used", "limit", "free", "use"))
+
+	base_modules = baseline.get("modules", {}) if baseline else {}
+	rows = []
+	for module in sorted(usage["modules"], key=lambda m: -usage["modules"][m]["ram"] - usage["modules"][m]["flash"]):
+		entry = usage["modules"][module]
+		base = base_modules.get(module, dict((k, 0) for k in KINDS))
+		delta = entry["ram"] - base.get("ram", 0)
+		rows.append("%-32s %8d %8d %8d %+8d" % (module, entry["flash"], entry["nvram"], entry["ram"],
+			delta if baseline else 0))
+	print_table("modules", rows, "%-32s %8s %8s %8s %8s" % ("module", "flash", "nvram", "ram", "ram+/-"))
+
+	for kind in ["ram", "flash"]:
+		symbols = [(k.split(":", 1)[1], v) for k, v in usage["symbols"].items() if k.startswith(kind + ":")]
+		symbols.sort(key=lambda s: -s[1])
+		rows = ["%-48s %8d" % s for s in symbols[:top]]
+		print_table("top %s symbols" % kind, rows, "%-48s %8s" % ("symbol", "size"))
+
+	if baseline:
+		for kind in KINDS:
+			allowed = baseline["totals"].get(kind, 0) + baseline.get("tolerance", {}).get(kind, 0)
+			if totals[kind] > allowed:
+				failures.append("%s regression: %d > %d bytes (baseline %d)" % (kind, totals[kind], allowed,
+					baseline["totals"].get(kind, 0)))
+
+	print("")
+	for failure in failures:
+		print("error: " + failure)
+	return failures
+
+
+def main():
+	parser = argparse.ArgumentParser(description="application memory budget")
+	parser.add_argument("map", help="linker map file (debug/app.map)")
+	parser.add_argument("--script", help="linker script to read STACK_SIZE from")
+	parser.add_argument("--baseline", help="json baseline to check the usage against")
+	parser.add_argument("--update-baseline", action="store_true", help="write the current usage as the baseline")
+	parser.add_argument("--json", help="write the usage to a json file (see profile_report.py)")
+	parser.add_argument("--top", type=int, default=20)
+	args = parser.parse_args()
+
+	regions, sections = parse_map(args.map)
+	if "SRAM" not in regions or "FLASH" not in regions:
+		print("error: no FLASH/SRAM memory regions in %s" % args.map)
+		return 1
+	stack_size = parse_stack_size(args.script) if args.script else 0
+	usage = account(regions, sections)
+
+	baseline = None
+	if args.baseline and os.path.exists(args.baseline) and not args.update_baseline:
+		baseline = json.load(open(args.baseline))
+	elif args.baseline and not args.update_baseline:
+		print("warning: no baseline %s, run the memory-baseline target" % args.baseline)
+
+	failures = report(usage, regions, stack_size, args.top, baseline)
+
+	if args.json:
+		with open(args.json, "w") as f:
+			json.dump({"totals": usage["totals"], "modules": usage["modules"]}, f, indent=1, sort_keys=True)
+			f.write("\n")
+
+	if args.update_baseline and args.baseline:
+		previous = {}
+		if os.path.exists(args.baseline):
+			previous = json.load(open(args.baseline))
+		with open(args.baseline, "w") as f:
+			json.dump({"totals": usage["totals"],
+				"tolerance": previous.get("tolerance", dict((k, 0) for k in KINDS)),
+				"modules": usage["modules"]}, f, indent=1, sort_keys=True)
+			f.write("\n")
+		print("baseline %s updated" % args.baseline)
+		return 0
+
+	return 1 if failures else 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
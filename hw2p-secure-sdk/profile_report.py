@@ -0,0 +1,151 @@
+"""
+*******************************************************************************
+*   Ledger SDK
+*   (c) 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+********************************************************************************
+
+Flash cost versus speed of the build profiles (make profile-report).
+  - flash: debug/profiles/<profile>.json, written by mapsize.py --json
+  - device: debug/profiles/<profile>.bench.json, written by bench.py hot
+    --json for an application built with the profile and HAVE_HOT_BENCH
+  - host: the host bench program (--host-bench) is built with the hot
+    sources at -Os and at the hot flags, each build prints one line per
+    function: name, ns per call
+"""
+
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import shlex
+import subprocess
+import sys
+import tempfile
+
+PROFILES = ["size", "balanced", "speed"]
+
+
+def load_profiles(directory, suffix):
+	profiles = []
+	names = [f[:-len(suffix)] for f in os.listdir(directory) if f.endswith(suffix)]
+	# .json also matches .bench.json
+	names = [n for n in names if "." not in n]
+	for name in sorted(names, key=lambda n: (PROFILES.index(n) if n in PROFILES else len(PROFILES), n)):
+		profiles.append((name, json.load(open(os.path.join(directory, name + suffix)))))
+	return profiles
+
+
+def print_table(title, header, rows):
+	print("")
+	print(title)
+	print("  " + header)
+	for row in rows:
+		print("  " + row)
+
+
+def report_flash(profiles, hot):
+	names = [name for name, _ in profiles]
+	header = "%-32s" % "module" + "".join("%10s" % n for n in names)
+	rows = []
+	modules = sorted(set(m for _, usage in profiles for m in usage["modules"]))
+	for module in modules:
+		sizes = [usage["modules"].get(module, {}).get("flash", 0) for _, usage in profiles]
+		# only the modules whose code changes with the profile
+		if module not in hot and len(set(sizes)) == 1:
+			continue
+		rows.append("%-32s" % (module + (" *" if module in hot else "")) + "".join("%10d" % s for s in sizes))
+	totals = [usage["totals"]["flash"] + usage["totals"]["nvram"] for _, usage in profiles]
+	rows.append("%-32s" % "total" + "".join("%10d" % t for t in totals))
+	rows.append("%-32s" % ("vs " + names[0]) + "".join("%+10d" % (t - totals[0]) for t in totals))
+	print_table("flash bytes per profile (* hot sources)", header, rows)
+	return dict(zip(names, totals))
+
+
+def report_timings(title, unit, columns):
+	names = [name for name, _ in columns]
+	functions = []
+	for _, timings in columns:
+		for function in timings:
+			if function not in functions:
+				functions.append(function)
+	header = "%-32s" % "function" + "".join("%10s" % n for n in names) + "%10s" % "saving"
+	rows = []
+	for function in functions:
+		values = [timings.get(function) for _, timings in columns]
+		cells = "".join("%10s" % ("%.1f" % v if v is not None else "-") for v in values)
+		saving = ""
+		if values[0] and values[-1] is not None:
+			saving = "%.1f%%" % (100.0 * (values[0] - values[-1]) / values[0])
+		rows.append("%-32s" % function + cells + "%10s" % saving)
+	print_table("%s (%s per call)" % (title, unit), header, rows)
+
+
+def host_bench(driver, sources, cflags, hot_cflags, compiler):
+	columns = []
+	workdir = tempfile.mkdtemp()
+	for level in ["-Os", hot_cflags]:
+		binary = os.path.join(workdir, "bench" + level.replace(" ", ""))
+		command = [compiler, "-O2"] + shlex.split(cflags) + [driver, "-o", binary]
+		# the hot sources are built at the level under test, the driver at -O2
+		objects = []
+		for source in sources:
+			obj = os.path.join(workdir, "%d%s.o" % (len(objects), level.replace(" ", "")))
+			subprocess.check_call([compiler, "-c"] + shlex.split(cflags) + shlex.split(level) +
+				[source, "-o", obj])
+			objects.append(obj)
+		subprocess.check_call(command + objects)
+		output = subprocess.check_output([binary]).decode()
+		timings = {}
+		for line in output.splitlines():
+			fields = line.split()
+			if len(fields) == 2:
+				timings[fields[0]] = float(fields[1])
+		columns.append((level, timings))
+	return columns
+
+
+def main():
+	parser = argparse.ArgumentParser(description="build profiles flash cost versus speed")
+	parser.add_argument("--dir", default="debug/profiles", help="profiles usage and timings")
+	parser.add_argument("--hot", action="append", default=[], help="module built with the hot flags")
+	parser.add_argument("--host-bench", help="host bench program source")
+	parser.add_argument("--host-cflags", default="", help="host bench flags (defines, include paths)")
+	parser.add_argument("--hot-cflags", default="-O2")
+	parser.add_argument("--host-cc", default=os.environ.get("HOST_CC", "cc"))
+	parser.add_argument("sources", nargs="*", help="hot sources linked with the host bench program")
+	args = parser.parse_args()
+
+	profiles = load_profiles(args.dir, ".json")
+	if not profiles:
+		print("error: no profile usage in %s, run make profile-report" % args.dir)
+		return 1
+	report_flash(profiles, args.hot)
+
+	device = load_profiles(args.dir, ".bench.json")
+	if device:
+		report_timings("device timings", "us", device)
+	else:
+		print("")
+		print("no device timings, see bench.py hot --json %s/<profile>.bench.json" % args.dir)
+
+	if args.host_bench:
+		report_timings("host timings", "ns", host_bench(args.host_bench, args.sources, args.host_cflags,
+			args.hot_cflags, args.host_cc))
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
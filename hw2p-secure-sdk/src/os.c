@@ -16,6 +16,7 @@
 ********************************************************************************/
 
 #include "os.h"
+#include "os_io_overlay.h"
 #include <string.h>
 
 // apdu buffer must hold a complete apdu to avoid troubles
@@ -30,10 +31,103 @@ void os_boot(void) {
 
   // at startup no exception context in use
   G_try_last_open_context = NULL;
+
+#ifdef HAVE_PIC_CACHE
+  // before any PIC()
+  pic_cache_init();
+#endif // HAVE_PIC_CACHE
+
+#ifdef HAVE_STACK_PAINT
+  os_stack_paint();
+#endif // HAVE_STACK_PAINT
+}
+
+#ifdef HAVE_STACK_PAINT
+#define STACK_PAINT_PATTERN 0xA5A5A5A5
+// words kept untouched below the painting function frame
+#define STACK_PAINT_MARGIN 8
+
+// provided by the linker script
+extern unsigned int _stack;
+extern unsigned int _estack;
+
+void os_stack_paint(void) {
+  volatile unsigned int marker;
+  unsigned int* p = &_stack;
+  while (p < (unsigned int*)&marker - STACK_PAINT_MARGIN) {
+    *p++ = STACK_PAINT_PATTERN;
+  }
+}
+
+unsigned int os_stack_max_usage(void) {
+  unsigned int* p = &_stack;
+  while (p < &_estack && *p == STACK_PAINT_PATTERN) {
+    p++;
+  }
+  return (unsigned int)&_estack - (unsigned int)p;
+}
+
+unsigned int os_stack_size(void) {
+  return (unsigned int)&_estack - (unsigned int)&_stack;
+}
+#endif // HAVE_STACK_PAINT
+
+#ifdef HAVE_TRY_STATS
+try_stats_t G_try_stats;
+
+void try_stats_reset(void) {
+  os_memset(&G_try_stats, 0, sizeof(G_try_stats));
+  G_try_stats.min_frame_address = 0xFFFFFFFF;
+}
+
+void try_stats_enter(try_context_t* context) {
+  unsigned int depth = 0;
+  try_context_t* c = context;
+  G_try_stats.frames++;
+  while (c) {
+    depth++;
+    c = c->previous;
+  }
+  if (depth > G_try_stats.max_depth) {
+    G_try_stats.max_depth = depth;
+  }
+  if ((unsigned int)context < G_try_stats.min_frame_address) {
+    G_try_stats.min_frame_address = (unsigned int)context;
+  }
+}
+#endif // HAVE_TRY_STATS
+
+#ifdef HAVE_IO_OVERLAY
+io_overlay_t G_io_overlay;
+
+#ifdef HAVE_IO_OVERLAY_CHECK
+unsigned int G_io_overlay_phases;
+
+#define IO_OVERLAY_MEMBER_LIVE(name, type, phases) \
+  if (G_io_overlay_phases & (phases)) {            \
+    live++;                                        \
+  }
+
+void io_overlay_enter(unsigned int phases) {
+  unsigned int live = 0;
+  G_io_overlay_phases |= phases;
+  IO_OVERLAY_MEMBERS(IO_OVERLAY_MEMBER_LIVE)
+  if (live > 1) {
+    G_io_overlay_phases &= ~phases;
+    THROW(EXCEPTION_IO_STATE);
+  }
 }
 
+void io_overlay_leave(unsigned int phases) {
+  G_io_overlay_phases &= ~phases;
+}
+#endif // HAVE_IO_OVERLAY_CHECK
+#endif // HAVE_IO_OVERLAY
+
 #ifdef HAVE_USB_APDU
+#ifndef HAVE_IO_OVERLAY
 unsigned char G_io_hid_chunk[IO_HID_EP_LENGTH];
+#endif // HAVE_IO_OVERLAY
 
 /**
  *  Ledger Protocol 
@@ -101,7 +195,15 @@ io_usb_hid_receive_status_t io_usb_hid_receive (io_send_t sndfct, unsigned char*
       l -= 2;
       // compute remaining size to receive
       G_io_usb_hid_remaining_length = G_io_usb_hid_total_length;
+#ifdef HAVE_IO_APDU_QUEUE
+      // queued when the previous command is still being processed
+      G_io_usb_hid_current_buffer = io_apdu_queue_rx_buffer();
+      if (G_io_usb_hid_current_buffer == NULL) {
+        goto apdu_reset;
+      }
+#else // HAVE_IO_APDU_QUEUE
       G_io_usb_hid_current_buffer = G_io_apdu_buffer;
+#endif // HAVE_IO_APDU_QUEUE
 
       if (l > G_io_usb_hid_remaining_length) {
         l = G_io_usb_hid_remaining_length;
@@ -156,6 +258,13 @@ io_usb_hid_receive_status_t io_usb_hid_receive (io_send_t sndfct, unsigned char*
 
   // reset sequence number for next exchange
   io_usb_hid_init();
+#ifdef HAVE_IO_APDU_QUEUE
+  // not reassembled in G_io_apdu_buffer but in a queue entry
+  if (G_io_usb_hid_current_buffer != G_io_apdu_buffer + G_io_usb_hid_total_length) {
+    io_apdu_queue_push(IO_APDU_MEDIA_USB_HID, G_io_usb_hid_total_length);
+    return IO_USB_APDU_QUEUED;
+  }
+#endif // HAVE_IO_APDU_QUEUE
   return IO_USB_APDU_RECEIVED;
 
 apdu_reset:
@@ -174,12 +283,12 @@ unsigned short io_usb_hid_exchange(io_send_t sndfct, unsigned short sndlength,
                                    io_recv_t rcvfct,
                                    unsigned char flags) {
   unsigned char l;
+  // the reception state is kept, the next command may be received while the
+  // reply is sent
+  unsigned int sequence_number = 0;
+  const unsigned char* tx_buffer = G_io_apdu_buffer;
 
   // perform send
-  if (sndlength) {
-    G_io_usb_hid_sequence_number = 0; 
-    G_io_usb_hid_current_buffer = G_io_apdu_buffer;
-  }
   while(sndlength) {
 
     // fill the chunk
@@ -187,34 +296,36 @@ unsigned short io_usb_hid_exchange(io_send_t sndfct, unsigned short sndlength,
 
     // keep the channel identifier
     G_io_hid_chunk[2] = 0x05;
-    G_io_hid_chunk[3] = G_io_usb_hid_sequence_number>>8;
-    G_io_hid_chunk[4] = G_io_usb_hid_sequence_number;
+    G_io_hid_chunk[3] = sequence_number>>8;
+    G_io_hid_chunk[4] = sequence_number;
 
-    if (G_io_usb_hid_sequence_number == 0) {
+    if (sequence_number == 0) {
       l = ((sndlength>IO_HID_EP_LENGTH-7) ? IO_HID_EP_LENGTH-7 : sndlength);
       G_io_hid_chunk[5] = sndlength>>8;
       G_io_hid_chunk[6] = sndlength;
-      os_memmove(G_io_hid_chunk+7, (const void*)G_io_usb_hid_current_buffer, l);
-      G_io_usb_hid_current_buffer += l;
+      os_memmove(G_io_hid_chunk+7, tx_buffer, l);
+      tx_buffer += l;
       sndlength -= l;
       l += 7;
     }
     else {
       l = ((sndlength>IO_HID_EP_LENGTH-5) ? IO_HID_EP_LENGTH-5 : sndlength);
-      os_memmove(G_io_hid_chunk+5, (const void*)G_io_usb_hid_current_buffer, l);
-      G_io_usb_hid_current_buffer += l;
+      os_memmove(G_io_hid_chunk+5, tx_buffer, l);
+      tx_buffer += l;
       sndlength -= l;
       l += 5;
     }
     // prepare next chunk numbering
-    G_io_usb_hid_sequence_number++;
+    sequence_number++;
     // send the chunk
     // always pad :)
     sndfct(G_io_hid_chunk, sizeof(G_io_hid_chunk));
   }
 
+#ifndef HAVE_IO_APDU_QUEUE
   // prepare for next apdu
   io_usb_hid_init();
+#endif // HAVE_IO_APDU_QUEUE
 
   if (flags & IO_RESET_AFTER_REPLIED) {
     reset();
@@ -246,63 +357,6 @@ unsigned short io_usb_hid_exchange(io_send_t sndfct, unsigned short sndlength,
 }
 #endif // HAVE_USB_APDU
 
-REENTRANT(void os_memmove(void * dst, const void WIDE * src, unsigned int length)) {
-#define DSTCHAR ((unsigned char *)dst)
-#define SRCCHAR ((unsigned char WIDE *)src)
-  if (dst > src) {
-    while(length--) {
-      DSTCHAR[length] = SRCCHAR[length];
-    }
-  }
-  else {
-    unsigned short l = 0;
-    while (length--) {
-      DSTCHAR[l] = SRCCHAR[l];
-      l++;
-    }
-  }
-#undef DSTCHAR
-}
-
-void os_memset(void * dst, unsigned char c, unsigned int length) {
-#define DSTCHAR ((unsigned char *)dst)
-  while(length--) {
-    DSTCHAR[length] = c;
-  }
-#undef DSTCHAR
-}
-
-char os_memcmp(const void WIDE * buf1, const void WIDE * buf2, unsigned int length) {
-#define BUF1 ((unsigned char const WIDE *)buf1)
-#define BUF2 ((unsigned char const WIDE *)buf2)
-  while(length--) {
-    if (BUF1[length] != BUF2[length]) {
-      return (BUF1[length] > BUF2[length])? 1:-1;
-    }
-  }
-  return 0;
-#undef BUF1
-#undef BUF2
-
-}
-
-void os_xor(void * dst, void WIDE* src1, void WIDE* src2, unsigned int length) {
-#define SRC1 ((unsigned char const WIDE *)src1)
-#define SRC2 ((unsigned char const WIDE *)src2)
-#define DST ((unsigned char *)dst)
-  unsigned short l = length;
-  // don't || to ensure all condition are evaluated
-  while(!(!length && !l)) {
-    length--;
-    l--;
-    DST[length] = SRC1[length] ^ SRC2[length];
-  }
-  // WHAT ??? glitch detected ?
-  if (l!=length) {
-    THROW(EXCEPTION);
-  }
-}
-
 #ifndef BOLOS_RELEASE
 void os_longjmp(jmp_buf b, unsigned int exception) {
   unsigned int lr;
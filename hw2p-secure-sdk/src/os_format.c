@@ -0,0 +1,185 @@
+/*******************************************************************************
+*   Ledger Nano S - Secure firmware
+*   (c) 2016, 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#include "os_format.h"
+
+#ifdef HAVE_FORMAT
+
+static const char const format_digits[] = {
+  '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+};
+
+void format_init(format_t* f, char* buf, unsigned int size) {
+  f->buf = buf;
+  f->size = size;
+  f->len = 0;
+  f->flags = 0;
+}
+
+void format_char(format_t* f, char c) {
+  if (f->flags & FORMAT_FLAG_RING) {
+    f->buf[f->len++ & (f->size - 1)] = c;
+    return;
+  }
+  // keep room for the terminating zero
+  if (f->len + 1 < f->size) {
+    f->buf[f->len++] = c;
+  }
+  else {
+    f->flags |= FORMAT_FLAG_TRUNCATED;
+  }
+}
+
+void format_str(format_t* f, const char WIDE* str) {
+  str = (const char WIDE*)PIC(str);
+  while (*str) {
+    format_char(f, *str++);
+  }
+}
+
+// digits are produced least significant first
+static void format_reversed(format_t* f, const char* digits, unsigned int count) {
+  while (count--) {
+    format_char(f, digits[count]);
+  }
+}
+
+void format_u32(format_t* f, uint32_t value) {
+  char digits[10];
+  unsigned int count = 0;
+  do {
+    digits[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  format_reversed(f, digits, count);
+}
+
+void format_s32(format_t* f, int32_t value) {
+  if (value < 0) {
+    format_char(f, '-');
+    format_u32(f, -(uint32_t)value);
+    return;
+  }
+  format_u32(f, value);
+}
+
+void format_x32(format_t* f, uint32_t value, unsigned int digits) {
+  while (digits--) {
+    format_char(f, format_digits[(value >> (digits * 4)) & 0xF]);
+  }
+}
+
+void format_hex(format_t* f, const void WIDE* data, unsigned int length) {
+  const unsigned char WIDE* bytes = (const unsigned char WIDE*)data;
+  while (length--) {
+    format_char(f, format_digits[*bytes >> 4]);
+    format_char(f, format_digits[*bytes & 0xF]);
+    bytes++;
+  }
+}
+
+void format_amount(format_t* f, uint64_t value, unsigned int decimals) {
+  // 64 bits value split in 16 bits limbs, each division by 10 stays in 32
+  // bits arithmetic (no 64 bits division helper)
+  unsigned short limbs[4];
+  // up to 20 digits, the integer digit included
+  char digits[FORMAT_AMOUNT_MAX_DECIMALS + 1];
+  unsigned int count = 0;
+  unsigned int i;
+  unsigned int nonzero;
+
+  if (decimals > FORMAT_AMOUNT_MAX_DECIMALS) {
+    THROW(INVALID_PARAMETER);
+  }
+
+  limbs[0] = value >> 48;
+  limbs[1] = value >> 32;
+  limbs[2] = value >> 16;
+  limbs[3] = value;
+  do {
+    uint32_t remainder = 0;
+    nonzero = 0;
+    for (i = 0; i < 4; i++) {
+      uint32_t current = (remainder << 16) | limbs[i];
+      limbs[i] = current / 10;
+      remainder = current % 10;
+      nonzero |= limbs[i];
+    }
+    digits[count++] = '0' + remainder;
+  } while (nonzero);
+
+  // at least one integer digit
+  while (count <= decimals) {
+    digits[count++] = '0';
+  }
+  format_reversed(f, digits + decimals, count - decimals);
+
+  // fractional part without its trailing zeros
+  i = 0;
+  while (i < decimals && digits[i] == '0') {
+    i++;
+  }
+  if (i < decimals) {
+    format_char(f, '.');
+    while (decimals-- > i) {
+      format_char(f, digits[decimals]);
+    }
+  }
+}
+
+unsigned int format_end(format_t* f) {
+  if (!(f->flags & FORMAT_FLAG_RING) && f->size) {
+    f->buf[f->len] = 0;
+  }
+  return f->len;
+}
+
+#ifdef HAVE_LOG_RING
+
+log_ring_t G_log_ring;
+
+void log_ring_open(format_t* f) {
+  f->buf = G_log_ring.data;
+  f->size = LOG_RING_SIZE;
+  // the ring size is a power of 2, the position wraps with written
+  f->len = G_log_ring.written;
+  f->flags = FORMAT_FLAG_RING;
+}
+
+void log_ring_close(format_t* f) {
+  format_char(f, '\n');
+  G_log_ring.written += (unsigned short)(f->len - (unsigned short)G_log_ring.written);
+}
+
+unsigned int log_ring_read(unsigned char* out, unsigned int out_size) {
+  unsigned int length = G_log_ring.written < LOG_RING_SIZE ? G_log_ring.written : LOG_RING_SIZE;
+  unsigned int start;
+  unsigned int i;
+  if (length > out_size) {
+    length = out_size;
+  }
+  // the most recent bytes when out is smaller than the ring
+  start = G_log_ring.written - length;
+  for (i = 0; i < length; i++) {
+    out[i] = G_log_ring.data[(start + i) & (LOG_RING_SIZE - 1)];
+  }
+  return length;
+}
+
+#endif // HAVE_LOG_RING
+
+#endif // HAVE_FORMAT
@@ -20,6 +20,13 @@
 #ifdef OS_IO_SEPROXYHAL
 
 #include "os_io_seproxyhal.h"
+#include "os_io_overlay.h"
+#include "os_io_trace.h"
+#include "os_nvm_cache.h"
+
+#ifdef HAVE_USB_CLASS_CCID
+#include "usbd_ccid_if.h"
+#endif // HAVE_USB_CLASS_CCID
 
 #ifdef HAVE_BLE
 #include "hci.h"
@@ -44,11 +51,112 @@ volatile io_apdu_media_t G_io_apdu_media;
 volatile unsigned int G_button_mask;
 volatile unsigned int G_button_same_mask_counter;
 
+#ifdef HAVE_IO_TRACE
+io_trace_t G_io_trace;
+
+unsigned int io_trace_dump(unsigned char* out, unsigned int out_size) {
+  uint32_t written = G_io_trace.written;
+  unsigned int count = written < IO_TRACE_SIZE ? written : IO_TRACE_SIZE;
+  unsigned int length = 8;
+  io_trace_record_t* record;
+
+  if (out_size < 8) {
+    return 0;
+  }
+  if (count > (out_size - 8) / 8) {
+    count = (out_size - 8) / 8;
+  }
+  out[0] = written >> 24;
+  out[1] = written >> 16;
+  out[2] = written >> 8;
+  out[3] = written;
+  out[4] = G_io_trace.tick >> 24;
+  out[5] = G_io_trace.tick >> 16;
+  out[6] = G_io_trace.tick >> 8;
+  out[7] = G_io_trace.tick;
+  // the most recent records when out is smaller than the ring
+  written -= count;
+  while (count--) {
+    record = &G_io_trace.records[written++ & (IO_TRACE_SIZE - 1)];
+    out[length++] = record->tick >> 8;
+    out[length++] = record->tick;
+    out[length++] = record->length >> 8;
+    out[length++] = record->length;
+    out[length++] = record->point;
+    out[length++] = record->tag;
+    out[length++] = record->ep;
+    out[length++] = record->state;
+  }
+  return length;
+}
+#endif // HAVE_IO_TRACE
+
+#ifdef HAVE_IO_APDU_QUEUE
+io_apdu_queue_t G_io_apdu_queue;
+#ifndef HAVE_IO_OVERLAY
+io_apdu_queue_entry_t G_io_apdu_queue_entries[IO_APDU_QUEUE_DEPTH];
+#endif // HAVE_IO_OVERLAY
+
+unsigned char* io_apdu_queue_rx_buffer(void) {
+  if (G_io_apdu_media == IO_APDU_MEDIA_NONE && G_io_apdu_queue.count == 0) {
+    return G_io_apdu_buffer;
+  }
+  if (G_io_apdu_queue.count == IO_APDU_QUEUE_DEPTH) {
+    G_io_apdu_queue.dropped++;
+    return NULL;
+  }
+  return G_io_apdu_queue_entries[(G_io_apdu_queue.head + G_io_apdu_queue.count) % IO_APDU_QUEUE_DEPTH].buffer;
+}
+
+void io_apdu_queue_push(io_apdu_media_t media, unsigned short length) {
+  io_apdu_queue_entry_t* entry = &G_io_apdu_queue_entries[(G_io_apdu_queue.head + G_io_apdu_queue.count) % IO_APDU_QUEUE_DEPTH];
+  entry->media = media;
+  entry->length = length;
+  G_io_apdu_queue.count++;
+  IO_TRACE(IO_TRACE_APDU_QUEUED, media, 0, length);
+}
+
+unsigned short io_apdu_queue_pop(void) {
+  io_apdu_queue_entry_t* entry = &G_io_apdu_queue_entries[G_io_apdu_queue.head];
+  if (G_io_apdu_queue.count == 0) {
+    return 0;
+  }
+  os_memmove(G_io_apdu_buffer, entry->buffer, entry->length);
+  switch (entry->media) {
+#ifdef HAVE_USB_APDU
+    case IO_APDU_MEDIA_USB_HID:
+      G_io_apdu_state = APDU_USB_HID;
+      break;
+#ifdef HAVE_USB_CLASS_CCID
+    case IO_APDU_MEDIA_USB_CCID:
+      G_io_apdu_state = APDU_USB_CCID;
+      break;
+#endif // HAVE_USB_CLASS_CCID
+#endif // HAVE_USB_APDU
+  }
+  G_io_apdu_media = entry->media; // for application code
+  G_io_apdu_length = entry->length;
+  G_io_apdu_queue.head = (G_io_apdu_queue.head + 1) % IO_APDU_QUEUE_DEPTH;
+  G_io_apdu_queue.count--;
+  return G_io_apdu_length;
+}
+
+void io_apdu_queue_reset(void) {
+  G_io_apdu_queue.head = 0;
+  G_io_apdu_queue.count = 0;
+}
+#endif // HAVE_IO_APDU_QUEUE
+
 void io_seproxyhal_general_status(void) {
   // avoid troubles
   if (io_seproxyhal_spi_is_status_sent()) {
     return;
   }
+#if defined(HAVE_IO_USB_TX_QUEUE) && defined(HAVE_L4_USBLIB)
+  // last chance for the transfers posted outside of an event, whatever the
+  // event being acknowledged
+  io_usb_tx_kick();
+#endif // HAVE_IO_USB_TX_QUEUE && HAVE_L4_USBLIB
   // send the general status
   G_io_seproxyhal_spi_buffer[0] = SEPROXYHAL_TAG_GENERAL_STATUS;
   G_io_seproxyhal_spi_buffer[1] = 0;
@@ -82,18 +190,141 @@ void io_seproxyhal_request_mcu_status(void) {
 //#define WAIT_MS(x) { volatile unsigned int i = 0xAA*x; while (i--); }
 
 #ifdef HAVE_IO_USB
+// hand an IN transfer to the MCU
+static void io_usb_ep_prepare_in(unsigned int ep, unsigned char* buffer, unsigned short length) {
+  G_io_seproxyhal_spi_buffer[0] = SEPROXYHAL_TAG_USB_EP_PREPARE;
+  G_io_seproxyhal_spi_buffer[1] = (3+length)>>8;
+  G_io_seproxyhal_spi_buffer[2] = (3+length);
+  G_io_seproxyhal_spi_buffer[3] = ep|0x80;
+  G_io_seproxyhal_spi_buffer[4] = SEPROXYHAL_TAG_USB_EP_PREPARE_DIR_IN;
+  G_io_seproxyhal_spi_buffer[5] = length;
+  io_seproxyhal_spi_send(G_io_seproxyhal_spi_buffer, 6);
+  io_seproxyhal_spi_send(buffer, length);
+}
+
 #ifdef HAVE_L4_USBLIB
-static volatile unsigned char G_io_usb_ep_xfer_len[IO_USB_MAX_ENDPOINTS];
 #include "usbd_def.h"
 #include "usbd_core.h"
+// sized after the endpoints registry when HAVE_USB_REGISTRY (usbd_conf.h)
+static volatile unsigned char G_io_usb_ep_xfer_len[IO_USB_MAX_ENDPOINTS];
 extern USBD_HandleTypeDef USBD_Device;
 
+#ifdef HAVE_IO_USB_TX_QUEUE
+typedef struct io_usb_tx_entry_s {
+  unsigned char* buffer;
+  io_usb_tx_done_t done;
+  unsigned short length;
+} io_usb_tx_entry_t;
+
+typedef struct io_usb_tx_queue_s {
+  io_usb_tx_entry_t entries[IO_USB_TX_QUEUE_DEPTH];
+  unsigned char head;
+  unsigned char count;
+  // the head transfer has been handed to the MCU
+  unsigned char started;
+} io_usb_tx_queue_t;
+
+// IN endpoints 1..IO_USB_MAX_ENDPOINTS-1
+static io_usb_tx_queue_t G_io_usb_tx_queues[IO_USB_MAX_ENDPOINTS-1];
+
+static void io_usb_tx_start(unsigned int ep) {
+  io_usb_tx_queue_t* queue = &G_io_usb_tx_queues[ep-1];
+  io_usb_tx_entry_t* entry;
+
+  // commands can only be sent before the general status of the event
+  if (queue->count == 0 || queue->started || io_seproxyhal_spi_is_status_sent()) {
+    return;
+  }
+  entry = &queue->entries[queue->head];
+  io_usb_ep_prepare_in(ep, entry->buffer, entry->length);
+  queue->started = 1;
+}
+
+unsigned int io_usb_tx_post(unsigned int ep, unsigned char* buffer, unsigned short length, io_usb_tx_done_t done) {
+  io_usb_tx_queue_t* queue;
+  io_usb_tx_entry_t* entry;
+
+  ep &= 0x7F;
+  // won't send if overflowing seproxyhal buffer format
+  if (ep == 0 || ep >= IO_USB_MAX_ENDPOINTS || length > 255) {
+    return 0;
+  }
+  queue = &G_io_usb_tx_queues[ep-1];
+  if (queue->count == IO_USB_TX_QUEUE_DEPTH) {
+    return 0;
+  }
+  entry = &queue->entries[(queue->head + queue->count) % IO_USB_TX_QUEUE_DEPTH];
+  entry->buffer = buffer;
+  entry->length = length;
+  entry->done = done;
+  queue->count++;
+  io_usb_tx_start(ep);
+  return 1;
+}
+
+unsigned int io_usb_tx_pending(unsigned int ep) {
+  ep &= 0x7F;
+  if (ep == 0 || ep >= IO_USB_MAX_ENDPOINTS) {
+    return 0;
+  }
+  return G_io_usb_tx_queues[ep-1].count;
+}
+
+void io_usb_tx_kick(void) {
+  unsigned int ep;
+  for (ep = 1; ep < IO_USB_MAX_ENDPOINTS; ep++) {
+    io_usb_tx_start(ep);
+  }
+}
+
+void io_usb_tx_reset(void) {
+  os_memset(G_io_usb_tx_queues, 0, sizeof(G_io_usb_tx_queues));
+}
+
+// IN transfer completion event
+static void io_usb_tx_complete(unsigned int ep, unsigned short length) {
+  io_usb_tx_queue_t* queue;
+  io_usb_tx_entry_t* entry;
+  io_usb_tx_done_t done;
+  unsigned char* buffer;
+
+  if (ep == 0 || ep >= IO_USB_MAX_ENDPOINTS) {
+    return;
+  }
+  queue = &G_io_usb_tx_queues[ep-1];
+  entry = &queue->entries[queue->head];
+  // not a queued transfer (io_usb_send_ep)
+  if (queue->count == 0 || !queue->started || entry->length != length) {
+    return;
+  }
+  done = entry->done;
+  buffer = entry->buffer;
+  queue->head = (queue->head + 1) % IO_USB_TX_QUEUE_DEPTH;
+  queue->count--;
+  queue->started = 0;
+
+  // next transfer first, the callback is free to post again
+  io_usb_tx_start(ep);
+  if (done) {
+    ((io_usb_tx_done_t)PIC(done))(ep|0x80, buffer, length);
+  }
+}
+#endif // HAVE_IO_USB_TX_QUEUE
+
 void io_seproxyhal_handle_usb_event(void) {
   switch(G_io_seproxyhal_spi_buffer[3]) {
     case SEPROXYHAL_TAG_USB_EVENT_RESET:
       // ongoing APDU detected, throw a reset
       USBD_LL_SetSpeed(&USBD_Device, USBD_SPEED_FULL);  
       USBD_LL_Reset(&USBD_Device);
+#ifdef HAVE_IO_USB_TX_QUEUE
+      // posted transfers won't complete on the new link
+      io_usb_tx_reset();
+#endif // HAVE_IO_USB_TX_QUEUE
+#ifdef HAVE_IO_APDU_QUEUE
+      // queued commands are not to be replied on the new link
+      io_apdu_queue_reset();
+#endif // HAVE_IO_APDU_QUEUE
       if (G_io_apdu_media == IO_APDU_MEDIA_USB_HID) {
         THROW(EXCEPTION_IO_RESET);
       }
@@ -115,6 +346,7 @@ uint16_t io_seproxyhal_get_ep_rx_size(uint8_t epnum) {
 }
 
 void io_seproxyhal_handle_usb_ep_xfer_event(void) {
+  IO_TRACE(IO_TRACE_EP_XFER, G_io_seproxyhal_spi_buffer[4], G_io_seproxyhal_spi_buffer[3], G_io_seproxyhal_spi_buffer[5]);
   switch(G_io_seproxyhal_spi_buffer[4]) {
     case SEPROXYHAL_TAG_USB_EP_XFER_SETUP:
       // assume length of setup packet, and that it is on endpoint 0
@@ -122,6 +354,9 @@ void io_seproxyhal_handle_usb_ep_xfer_event(void) {
       break;
 
     case SEPROXYHAL_TAG_USB_EP_XFER_IN:
+#ifdef HAVE_IO_USB_TX_QUEUE
+      io_usb_tx_complete(G_io_seproxyhal_spi_buffer[3]&0x7F, G_io_seproxyhal_spi_buffer[5]);
+#endif // HAVE_IO_USB_TX_QUEUE
       USBD_LL_DataInStage(&USBD_Device, G_io_seproxyhal_spi_buffer[3]&0x7F, &G_io_seproxyhal_spi_buffer[6]);
       break;
 
@@ -156,14 +391,7 @@ void io_usb_send_ep(unsigned int ep, unsigned char* buffer, unsigned short lengt
     return;
   }
   
-  G_io_seproxyhal_spi_buffer[0] = SEPROXYHAL_TAG_USB_EP_PREPARE;
-  G_io_seproxyhal_spi_buffer[1] = (3+length)>>8;
-  G_io_seproxyhal_spi_buffer[2] = (3+length);
-  G_io_seproxyhal_spi_buffer[3] = ep|0x80;
-  G_io_seproxyhal_spi_buffer[4] = SEPROXYHAL_TAG_USB_EP_PREPARE_DIR_IN;
-  G_io_seproxyhal_spi_buffer[5] = length;
-  io_seproxyhal_spi_send(G_io_seproxyhal_spi_buffer, 6);
-  io_seproxyhal_spi_send(buffer, length);
+  io_usb_ep_prepare_in(ep, buffer, length);
 
   // if timeout is requested
   if(timeout) {
@@ -190,6 +418,9 @@ void io_usb_send_ep(unsigned int ep, unsigned char* buffer, unsigned short lengt
         // link disconnected ?
         if(G_io_seproxyhal_spi_buffer[0] == SEPROXYHAL_TAG_STATUS_EVENT) {
           if (!(U4BE(G_io_seproxyhal_spi_buffer, 3) & SEPROXYHAL_TAG_STATUS_EVENT_FLAG_USB_POWERED)) {
+#ifdef HAVE_IO_WARM_RESET
+           G_io_reset_flags |= IO_RESET_FLAG_USB_UNPOWERED;
+#endif // HAVE_IO_WARM_RESET
            THROW(EXCEPTION_IO_RESET);
           }
         }
@@ -291,15 +522,16 @@ const char debug_apdus[] = {
 };
 #endif // DEBUG_APDU
 
-void io_seproxyhal_init(void) {
-  // Enforce OS compatibility
-  check_api_level(CX_COMPAT_APILEVEL);
-
+// transport state machines back to idle
+static void io_seproxyhal_init_transport(void) {
   G_io_apdu_state = APDU_IDLE;
   G_io_apdu_offset = 0;
   G_io_apdu_length = 0;
   G_io_apdu_seq = 0;
   G_io_apdu_media = IO_APDU_MEDIA_NONE;
+#ifdef HAVE_IO_APDU_QUEUE
+  io_apdu_queue_reset();
+#endif // HAVE_IO_APDU_QUEUE
 
   #ifdef DEBUG_APDU
   debug_apdus_offset = 0;
@@ -310,10 +542,52 @@ void io_seproxyhal_init(void) {
   io_usb_hid_init();
   #endif // HAVE_USB_APDU
 
+#ifdef HAVE_IO_USB_TX_QUEUE
+  io_usb_tx_reset();
+#endif // HAVE_IO_USB_TX_QUEUE
+}
+
+void io_seproxyhal_init(void) {
+  // Enforce OS compatibility
+  check_api_level(CX_COMPAT_APILEVEL);
+
+  io_seproxyhal_init_transport();
+#ifdef HAVE_IO_WARM_RESET
+  G_io_reset_flags = 0;
+#endif // HAVE_IO_WARM_RESET
+
   io_seproxyhal_init_ux();
   io_seproxyhal_init_button();
 }
 
+#ifdef HAVE_IO_WARM_RESET
+unsigned char G_io_reset_flags;
+
+unsigned int io_seproxyhal_warm_reset(void) {
+  unsigned char flags = G_io_reset_flags;
+  G_io_reset_flags = 0;
+
+#if defined(HAVE_IO_USB) && defined(HAVE_L4_USBLIB)
+  // after a bus reset or a link loss the host enumerates the device again
+  if ((flags & IO_RESET_FLAG_USB_UNPOWERED)
+    || USBD_Device.dev_state != USBD_STATE_CONFIGURED) {
+    return 0;
+  }
+#else // HAVE_IO_USB && HAVE_L4_USBLIB
+  UNUSED(flags);
+#endif // HAVE_IO_USB && HAVE_L4_USBLIB
+
+  io_seproxyhal_init_transport();
+#ifdef HAVE_USB_CLASS_CCID
+  // endpoints stay configured, the CCID state is reset and its bulk OUT
+  // endpoint primed again for the next command
+  CCID_Init(&USBD_Device);
+#endif // HAVE_USB_CLASS_CCID
+  io_seproxyhal_init_button();
+  return 1;
+}
+#endif // HAVE_IO_WARM_RESET
+
 void io_seproxyhal_init_ux(void) {
   // initialize the touch part
   G_bagl_last_touched_not_released_component = NULL;
@@ -532,6 +806,9 @@ void io_seproxyhal_display_bitmap(int x, int y, unsigned int w, unsigned int h,
   d.bpp = bit_per_pixel;
   d.colors = color_index;
   d.bitmap = bitmap;
+#ifdef HAVE_GLYPH_RLE
+  d.format = BAGL_ICON_FORMAT_RAW;
+#endif // HAVE_GLYPH_RLE
 
   io_seproxyhal_display_icon(&c, &d);
   /*
@@ -555,18 +832,83 @@ void io_seproxyhal_display_bitmap(int x, int y, unsigned int w, unsigned int h,
   */
 }
 
+// sequential access to the bitmap of an icon, decoded on the fly
+typedef struct icon_bitmap_reader_s {
+  const unsigned char* bitmap;
+  unsigned int offset;
+#ifdef HAVE_GLYPH_RLE
+  unsigned int format;
+  // remaining bytes of the current packbits packet
+  unsigned int count;
+  unsigned int repeat;
+#endif // HAVE_GLYPH_RLE
+} icon_bitmap_reader_t;
+
+static void icon_bitmap_reader_init(icon_bitmap_reader_t* reader, bagl_icon_details_t* icon_details) {
+  os_memset(reader, 0, sizeof(icon_bitmap_reader_t));
+  reader->bitmap = (const unsigned char*)PIC(icon_details->bitmap);
+#ifdef HAVE_GLYPH_RLE
+  reader->format = icon_details->format;
+#endif // HAVE_GLYPH_RLE
+}
+
+// send the next len bytes of the decoded bitmap
+static void icon_bitmap_reader_send(icon_bitmap_reader_t* reader, unsigned int len) {
+#ifdef HAVE_GLYPH_RLE
+  if (reader->format == BAGL_ICON_FORMAT_RLE) {
+    unsigned char buf[32];
+    while (len) {
+      unsigned int fill = 0;
+      while (fill < sizeof(buf) && fill < len) {
+        unsigned int n;
+        if (reader->count == 0) {
+          unsigned int header = reader->bitmap[reader->offset++];
+          // 128 is a no-op header
+          if (header == 128) {
+            continue;
+          }
+          // <header+1 literal bytes> or <257-header times the next byte>
+          reader->repeat = header > 128;
+          reader->count = reader->repeat ? 257 - header : header + 1;
+        }
+        n = MIN(reader->count, MIN(sizeof(buf), len) - fill);
+        if (reader->repeat) {
+          os_memset(buf+fill, reader->bitmap[reader->offset], n);
+        }
+        else {
+          os_memmove(buf+fill, reader->bitmap+reader->offset, n);
+          reader->offset += n;
+        }
+        reader->count -= n;
+        // run byte consumed
+        if (reader->repeat && reader->count == 0) {
+          reader->offset++;
+        }
+        fill += n;
+      }
+      io_seproxyhal_spi_send(buf, fill);
+      len -= fill;
+    }
+    return;
+  }
+#endif // HAVE_GLYPH_RLE
+  io_seproxyhal_spi_send(reader->bitmap+reader->offset, len);
+  reader->offset += len;
+}
+
 void io_seproxyhal_display_icon(bagl_component_t* icon_component, bagl_icon_details_t* icon_details) {
   bagl_component_t icon_component_mod;
+  icon_bitmap_reader_t reader;
   // ensure not being out of bounds in the icon component agianst the declared icon real size
   os_memmove(&icon_component_mod, icon_component, sizeof(bagl_component_t));
   icon_component_mod.width = icon_details->width;
   icon_component_mod.height = icon_details->height;
   icon_component = &icon_component_mod;
+  icon_bitmap_reader_init(&reader, icon_details);
 
 #ifdef SEPROXYHAL_TAG_SCREEN_DISPLAY_RAW_STATUS
   unsigned int len;
   unsigned int icon_len;
-  unsigned int icon_off=0;
 
   struct display_raw_s {
     struct {
@@ -596,7 +938,11 @@ void io_seproxyhal_display_icon(bagl_component_t* icon_component, bagl_icon_deta
   } __attribute__((packed)) raw;
 
   raw.header.seph.tag = SEPROXYHAL_TAG_SCREEN_DISPLAY_RAW_STATUS;
+#ifdef HAVE_DISPLAY_RAW_STREAM
+  raw.header.type = SEPROXYHAL_TAG_SCREEN_DISPLAY_RAW_STATUS_STREAM_START;
+#else // HAVE_DISPLAY_RAW_STREAM
   raw.header.type = SEPROXYHAL_TAG_SCREEN_DISPLAY_RAW_STATUS_START;
+#endif // HAVE_DISPLAY_RAW_STREAM
   raw.x.val = icon_component->x;
   raw.y.val = icon_component->y;
   raw.w.val = icon_component->width;
@@ -606,7 +952,7 @@ void io_seproxyhal_display_icon(bagl_component_t* icon_component, bagl_icon_deta
 
   icon_len = raw.w.val*raw.h.val*raw.bpp/8 + (((raw.w.val*raw.h.val*raw.bpp)%8)?1:0);
 
-  // optional, don't send too much on a single packet for MCU to receive it. when stream mode will be on, this will be useless
+  // optional, don't send too much on a single packet for MCU to receive it. with HAVE_DISPLAY_RAW_STREAM, the following chunks are sent in bursts
   // min of remaining space in the packet vs. total icon size + color index size
   len = MIN(sizeof(G_io_seproxyhal_spi_buffer) - sizeof(raw), icon_len + (1<<raw.bpp)*4);
 
@@ -623,26 +969,52 @@ void io_seproxyhal_display_icon(bagl_component_t* icon_component, bagl_icon_deta
   io_seproxyhal_spi_send(&raw, sizeof(raw));
   io_seproxyhal_spi_send(PIC(icon_details->colors), (1<<raw.bpp)*4);
   len -= (1<<raw.bpp)*4;
-  io_seproxyhal_spi_send(PIC(icon_details->bitmap), len);
+  icon_bitmap_reader_send(&reader, len);
   // advance in the bitmap to be transmitted
   icon_len -= len;
-  icon_off += len;
 
   // still some bitmap data to transmit
   while(icon_len) {
+#ifdef HAVE_DISPLAY_RAW_STREAM
+    unsigned int credits = 1;
+#endif // HAVE_DISPLAY_RAW_STREAM
+
     // wait displayed event
     io_seproxyhal_spi_recv(G_io_seproxyhal_spi_buffer, sizeof(G_io_seproxyhal_spi_buffer), 0);
-    
+
+#ifdef HAVE_DISPLAY_RAW_STREAM
+    // the MCU grants a window of chunks, sent in a single burst. chunks are
+    // sent as commands, but the last one of the window which closes the
+    // exchange and is replied with the next credits
+    if (G_io_seproxyhal_spi_buffer[0] == SEPROXYHAL_TAG_DISPLAY_PROCESSED_EVENT
+      && U2BE(G_io_seproxyhal_spi_buffer, 1) >= 1
+      && G_io_seproxyhal_spi_buffer[3]) {
+      credits = G_io_seproxyhal_spi_buffer[3];
+    }
+    for (;;) {
+      len = MIN((sizeof(G_io_seproxyhal_spi_buffer) - sizeof(raw.header)), icon_len);
+      if (credits == 1 || len == icon_len) {
+        break;
+      }
+      G_io_seproxyhal_spi_buffer[0] = SEPROXYHAL_TAG_SCREEN_DISPLAY_RAW_STREAM;
+      G_io_seproxyhal_spi_buffer[1] = len>>8;
+      G_io_seproxyhal_spi_buffer[2] = len;
+      io_seproxyhal_spi_send(G_io_seproxyhal_spi_buffer, 3);
+      icon_bitmap_reader_send(&reader, len);
+      icon_len -= len;
+      credits--;
+    }
+#endif // HAVE_DISPLAY_RAW_STREAM
+
     raw.header.type = SEPROXYHAL_TAG_SCREEN_DISPLAY_RAW_STATUS_CONT;
     
     len = MIN((sizeof(G_io_seproxyhal_spi_buffer) - sizeof(raw.header)), icon_len);
     raw.header.seph.len[0] = (len+1)>>8;
     raw.header.seph.len[1] = (len+1);
     io_seproxyhal_spi_send(&raw.header, sizeof(raw.header));
-    io_seproxyhal_spi_send(PIC(icon_details->bitmap)+icon_off, len);
+    icon_bitmap_reader_send(&reader, len);
 
     icon_len -= len;
-    icon_off += len;
   }
 #else // !SEPROXYHAL_TAG_SCREEN_DISPLAY_RAW_STATUS // for nano s
   // component type = ICON, provided bitmap
@@ -665,7 +1037,7 @@ void io_seproxyhal_display_icon(bagl_component_t* icon_component, bagl_icon_deta
   G_io_seproxyhal_spi_buffer[0] = icon_details->bpp;
   io_seproxyhal_spi_send(G_io_seproxyhal_spi_buffer, 1);
   io_seproxyhal_spi_send((unsigned char*)PIC(icon_details->colors), h);
-  io_seproxyhal_spi_send((unsigned char*)PIC(icon_details->bitmap), w);
+  icon_bitmap_reader_send(&reader, w);
 #endif // !SEPROXYHAL_TAG_SCREEN_DISPLAY_RAW_STATUS
 }
 
@@ -839,6 +1211,232 @@ void io_seproxyhal_button_push(button_push_callback_t button_callback, unsigned
   }
 }
 
+#ifdef HAVE_UX_SCENE
+// retained scene of the current screen
+ux_scene_t ux_scene;
+
+#define UX_SCENE_HASH_OFFSET 2166136261UL
+#define UX_SCENE_HASH_PRIME 16777619UL
+
+// FNV-1a
+static unsigned int ux_scene_hash_update(unsigned int hash, const unsigned char* data, unsigned int length) {
+  while (length--) {
+    hash = (hash ^ *data++) * UX_SCENE_HASH_PRIME;
+  }
+  return hash;
+}
+
+static unsigned int ux_scene_hash_word(unsigned int hash, unsigned int value) {
+  unsigned char word[4];
+  word[0] = value;
+  word[1] = value>>8;
+  word[2] = value>>16;
+  word[3] = value>>24;
+  return ux_scene_hash_update(hash, word, 4);
+}
+
+// hash of what is sent by io_seproxyhal_display_default, 0 when nothing is displayed
+static unsigned int ux_scene_hash(const bagl_element_t* element) {
+  const bagl_component_t* c = &element->component;
+  unsigned int type = (c->type & ~(BAGL_FLAG_TOUCHABLE));
+  unsigned int hash = UX_SCENE_HASH_OFFSET;
+
+  if (type == BAGL_NONE) {
+    return 0;
+  }
+
+  // hash fields, structure padding is not initialized for elements built in ram
+  hash = ux_scene_hash_word(hash, c->type | (c->userid<<8) | (c->stroke<<16) | (c->radius<<24));
+  hash = ux_scene_hash_word(hash, (unsigned short)c->x | ((unsigned short)c->y<<16));
+  hash = ux_scene_hash_word(hash, c->width | (c->height<<16));
+  hash = ux_scene_hash_word(hash, c->fill | (c->icon_id<<8) | (c->font_id<<16));
+  hash = ux_scene_hash_word(hash, c->fgcolor);
+  hash = ux_scene_hash_word(hash, c->bgcolor);
+
+  if (element->text != NULL) {
+    unsigned int text_adr = PIC((unsigned int)element->text);
+    // icon details are considered constant, only their address is hashed
+    if (type == BAGL_ICON && c->icon_id == 0) {
+      hash = ux_scene_hash_word(hash, text_adr);
+    }
+    else {
+      hash = ux_scene_hash_update(hash, (const unsigned char*)text_adr, strlen((const char*)text_adr));
+    }
+  }
+
+  // 0 is reserved for not displayed elements
+  return hash ? hash : 1;
+}
+
+static void ux_scene_element_rect(ux_scene_rect_t* rect, const bagl_element_t* element) {
+  rect->x = element->component.x;
+  rect->y = element->component.y;
+  rect->width = element->component.width;
+  rect->height = element->component.height;
+  // y is the baseline of a label line, leave room for the descenders
+  if ((element->component.type & ~(BAGL_FLAG_TOUCHABLE)) == BAGL_LABELINE) {
+    rect->y -= element->component.height;
+    rect->height += element->component.height/2;
+  }
+}
+
+// filled rectangles can be redrawn partially, as long as the clipped version
+// draws the same pixels
+static unsigned int ux_scene_element_clippable(const bagl_element_t* element) {
+  return (element->component.type & ~(BAGL_FLAG_TOUCHABLE)) == BAGL_RECTANGLE
+    && element->component.fill == BAGL_FILL
+    && element->component.stroke == 0
+    && element->component.radius == 0
+    && element->text == NULL;
+}
+
+static void ux_scene_rect_union(ux_scene_rect_t* rect, const ux_scene_rect_t* other) {
+  int x1, y1;
+  if (other->width == 0 || other->height == 0) {
+    return;
+  }
+  if (rect->width == 0 || rect->height == 0) {
+    os_memmove(rect, other, sizeof(ux_scene_rect_t));
+    return;
+  }
+  x1 = MAX(rect->x + rect->width, other->x + other->width);
+  y1 = MAX(rect->y + rect->height, other->y + other->height);
+  rect->x = MIN(rect->x, other->x);
+  rect->y = MIN(rect->y, other->y);
+  rect->width = x1 - rect->x;
+  rect->height = y1 - rect->y;
+}
+
+// return 0 when not intersecting, else the intersection is stored in out (if not NULL)
+static unsigned int ux_scene_rect_intersect(ux_scene_rect_t* out, const ux_scene_rect_t* a, const ux_scene_rect_t* b) {
+  int x0 = MAX(a->x, b->x);
+  int y0 = MAX(a->y, b->y);
+  int x1 = MIN(a->x + a->width, b->x + b->width);
+  int y1 = MIN(a->y + a->height, b->y + b->height);
+  if (x1 <= x0 || y1 <= y0) {
+    return 0;
+  }
+  if (out) {
+    out->x = x0;
+    out->y = y0;
+    out->width = x1 - x0;
+    out->height = y1 - y0;
+  }
+  return 1;
+}
+
+void ux_scene_invalidate(void) {
+  ux_scene.elements_count = 0;
+  ux_scene.redraw_mask = 0;
+}
+
+void ux_scene_plan(unsigned int index) {
+  unsigned int i;
+  unsigned int full;
+  unsigned int changed_mask = 0;
+  ux_scene_rect_t dirty;
+
+  // partial redisplay or large screen, all elements are sent and the next
+  // redisplay is a full one
+  if (index != 0 || ux.elements_count > UX_SCENE_MAX_ELEMENTS) {
+    ux_scene_invalidate();
+    return;
+  }
+
+  // another screen, or the previous redisplay has not completed
+  full = (ux_scene.elements_count == 0
+    || ux_scene.elements != ux.elements
+    || ux_scene.elements_count != ux.elements_count
+    || ux_scene.redraw_mask);
+
+  // compare with the retained elements, the dirty area covers the previous
+  // and the new area of the changed elements
+  os_memset(&dirty, 0, sizeof(dirty));
+  ux_scene.clip_mask = 0;
+  for (i = 0; i < ux.elements_count; i++) {
+    const bagl_element_t* element = &ux.elements[i];
+    unsigned int hash = 0;
+    ux_scene_rect_t rect;
+
+    os_memset(&rect, 0, sizeof(rect));
+    if (ux.elements_preprocessor) {
+      element = ux.elements_preprocessor(element);
+      if ((unsigned int)element == 1) {
+        element = &ux.elements[i];
+      }
+    }
+    if (element) {
+      hash = ux_scene_hash(element);
+      ux_scene_element_rect(&rect, element);
+      if (ux_scene_element_clippable(element)) {
+        ux_scene.clip_mask |= 1<<i;
+      }
+      // kept for the display, the preprocessor is not called again
+      os_memmove(&ux_scene.element[i], element, sizeof(bagl_element_t));
+    }
+
+    if (full || hash != ux_scene.hash[i]) {
+      changed_mask |= 1<<i;
+      if (!full && ux_scene.hash[i]) {
+        ux_scene_rect_union(&dirty, &ux_scene.rect[i]);
+      }
+      if (hash) {
+        ux_scene_rect_union(&dirty, &rect);
+      }
+    }
+    ux_scene.hash[i] = hash;
+    os_memmove(&ux_scene.rect[i], &rect, sizeof(rect));
+  }
+
+  ux_scene.elements = ux.elements;
+  ux_scene.elements_count = ux.elements_count;
+  os_memmove(&ux_scene.dirty, &dirty, sizeof(dirty));
+
+  // elements are drawn in order, unchanged elements overlapping the dirty area
+  // are redrawn, growing it for the following elements, but for the clipped ones
+  ux_scene.redraw_mask = 0;
+  for (i = 0; i < ux.elements_count; i++) {
+    unsigned int mask = 1<<i;
+    if (!ux_scene.hash[i]) {
+      continue;
+    }
+    if (changed_mask & mask) {
+      ux_scene.redraw_mask |= mask;
+      ux_scene.clip_mask &= ~mask;
+    }
+    else if (ux_scene_rect_intersect(NULL, &ux_scene.rect[i], &dirty)) {
+      ux_scene.redraw_mask |= mask;
+      if (!(ux_scene.clip_mask & mask)) {
+        ux_scene_rect_union(&dirty, &ux_scene.rect[i]);
+      }
+    }
+  }
+}
+
+const bagl_element_t* ux_scene_element(unsigned int index) {
+  unsigned int mask = 1<<index;
+
+  if (!(ux_scene.redraw_mask & mask)) {
+    return NULL;
+  }
+  ux_scene.redraw_mask &= ~mask;
+
+  // replay the dirty area growth, as planned
+  if (ux_scene.clip_mask & mask) {
+    ux_scene_rect_t rect;
+    ux_scene_rect_intersect(&rect, &ux_scene.rect[index], &ux_scene.dirty);
+    ux_scene.element[index].component.x = rect.x;
+    ux_scene.element[index].component.y = rect.y;
+    ux_scene.element[index].component.width = rect.width;
+    ux_scene.element[index].component.height = rect.height;
+  }
+  else {
+    ux_scene_rect_union(&ux_scene.dirty, &ux_scene.rect[index]);
+  }
+  return &ux_scene.element[index];
+}
+#endif // HAVE_UX_SCENE
+
 #endif // HAVE_BAGL
 
 unsigned short io_exchange(unsigned char channel, unsigned short tx_len) {
@@ -870,6 +1468,12 @@ unsigned short io_exchange(unsigned char channel, unsigned short tx_len) {
     // TODO work up the spi state machine over the HAL proxy until an APDU is available
 
     if (tx_len && !(channel&IO_ASYNCH_REPLY)) {
+      IO_TRACE(IO_TRACE_APDU_TX, 0, 0, tx_len);
+
+#ifdef HAVE_NVM_CACHE
+      // the NVRAM writes of the command are persisted before it is replied
+      nvm_cache_commit();
+#endif // HAVE_NVM_CACHE
 
       // until the whole RAPDU is transmitted, send chunks using the current mode for communication
       for (;;) {
@@ -916,6 +1520,13 @@ unsigned short io_exchange(unsigned char channel, unsigned short tx_len) {
         if (channel & IO_RETURN_AFTER_TX) {
           return 0;
         }
+#ifdef HAVE_IO_APDU_QUEUE
+        // the next command has already been received, keep the hand to reply
+        // to it, it is delivered below
+        if (G_io_apdu_queue.count) {
+          break;
+        }
+#endif // HAVE_IO_APDU_QUEUE
         // acknowledge the write request (general status OK) and no more command to follow (wait until another APDU container is received to continue unwrapping)
         io_seproxyhal_general_status();
         break;
@@ -941,6 +1552,14 @@ unsigned short io_exchange(unsigned char channel, unsigned short tx_len) {
       G_io_apdu_length = 0;
       G_io_apdu_seq = 0;
       G_io_apdu_media = IO_APDU_MEDIA_NONE;
+
+#ifdef HAVE_IO_APDU_QUEUE
+      // received while the previous command was processed
+      if (io_apdu_queue_pop()) {
+        IO_TRACE(IO_TRACE_APDU_RX, G_io_apdu_media, 0, G_io_apdu_length);
+        return G_io_apdu_length;
+      }
+#endif // HAVE_IO_APDU_QUEUE
     }
 
     // ensure ready to receive an event (after an apdu processing with asynch flag, it may occur if the channel is not correctly managed)
@@ -986,6 +1605,7 @@ unsigned short io_exchange(unsigned char channel, unsigned short tx_len) {
           if (G_io_apdu_length) {
             G_io_apdu_media = IO_APDU_MEDIA_BLE; // for application code
             G_io_apdu_state = APDU_BLE; // for next call to io_exchange
+            IO_TRACE(IO_TRACE_APDU_RX, G_io_apdu_media, 0, G_io_apdu_length);
             return G_io_apdu_length;
           } 
           goto send_last_command;
@@ -1009,9 +1629,18 @@ unsigned short io_exchange(unsigned char channel, unsigned short tx_len) {
           }
           io_seproxyhal_handle_usb_ep_xfer_event();
 
+#ifdef HAVE_IO_APDU_QUEUE
+          // the reassembly of a command started while the previous one was
+          // processed has completed in the queue
+          if (G_io_apdu_length == 0) {
+            io_apdu_queue_pop();
+          }
+#endif // HAVE_IO_APDU_QUEUE
+
           // an apdu has been received, ack with mode commands (the reply at least)
           if (G_io_apdu_length > 0) {
             // invalid return when reentered and an apdu is already under processing
+            IO_TRACE(IO_TRACE_APDU_RX, G_io_apdu_media, 0, G_io_apdu_length);
             return G_io_apdu_length;
           }
           else {
@@ -1137,14 +1766,9 @@ const bagl_element_t* ux_menu_element_preprocessor(const bagl_element_t* element
   // ask the current entry first, to setup other entries
   const ux_menu_entry_t* current_entry = ux_menu_get_entry(ux_menu.current_entry);
 
-  const ux_menu_entry_t* previous_entry = NULL;
-  if (ux_menu.current_entry) {
-    previous_entry = ux_menu_get_entry(ux_menu.current_entry-1);
-  }
-  const ux_menu_entry_t* next_entry = NULL;
-  if (ux_menu.current_entry < ux_menu.menu_entries_count-1) {
-    next_entry = ux_menu_get_entry(ux_menu.current_entry+1);
-  }
+  // previous and next entries are only requested for the elements displaying them
+  const ux_menu_entry_t* previous_entry;
+  const ux_menu_entry_t* next_entry;
 
   switch(element->component.userid) {
     case 0x81:
@@ -1162,8 +1786,11 @@ const bagl_element_t* ux_menu_element_preprocessor(const bagl_element_t* element
       if (current_entry->line2 != NULL 
         || current_entry->icon != NULL
         || ux_menu.current_entry == 0
-        || ux_menu.menu_entries_count == 1 
-        || previous_entry->icon != NULL
+        || ux_menu.menu_entries_count == 1) {
+        return 0;
+      }
+      previous_entry = ux_menu_get_entry(ux_menu.current_entry-1);
+      if (previous_entry->icon != NULL
         || previous_entry->line2 != NULL) {
         return 0;
       }
@@ -1174,8 +1801,11 @@ const bagl_element_t* ux_menu_element_preprocessor(const bagl_element_t* element
       if (current_entry->line2 != NULL 
         || current_entry->icon != NULL
         || ux_menu.current_entry == ux_menu.menu_entries_count-1
-        || ux_menu.menu_entries_count == 1
-        || next_entry->icon != NULL) {
+        || ux_menu.menu_entries_count == 1) {
+        return NULL;
+      }
+      next_entry = ux_menu_get_entry(ux_menu.current_entry+1);
+      if (next_entry->icon != NULL) {
         return NULL;
       }
       ux_menu.tmp_element.text = next_entry->line1;
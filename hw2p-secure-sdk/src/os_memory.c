@@ -0,0 +1,79 @@
+/*******************************************************************************
+*   Ledger Nano S - Secure firmware
+*   (c) 2016, 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#include "os.h"
+
+// Memory primitives, kept out of os.c so that a build profile can optimize
+// them for speed without the rest of the os (see HOT_SOURCES in
+// Makefile.rules).
+
+REENTRANT(void os_memmove(void * dst, const void WIDE * src, unsigned int length)) {
+#define DSTCHAR ((unsigned char *)dst)
+#define SRCCHAR ((unsigned char WIDE *)src)
+  if (dst > src) {
+    while(length--) {
+      DSTCHAR[length] = SRCCHAR[length];
+    }
+  }
+  else {
+    unsigned short l = 0;
+    while (length--) {
+      DSTCHAR[l] = SRCCHAR[l];
+      l++;
+    }
+  }
+#undef DSTCHAR
+}
+
+void os_memset(void * dst, unsigned char c, unsigned int length) {
+#define DSTCHAR ((unsigned char *)dst)
+  while(length--) {
+    DSTCHAR[length] = c;
+  }
+#undef DSTCHAR
+}
+
+char os_memcmp(const void WIDE * buf1, const void WIDE * buf2, unsigned int length) {
+#define BUF1 ((unsigned char const WIDE *)buf1)
+#define BUF2 ((unsigned char const WIDE *)buf2)
+  while(length--) {
+    if (BUF1[length] != BUF2[length]) {
+      return (BUF1[length] > BUF2[length])? 1:-1;
+    }
+  }
+  return 0;
+#undef BUF1
+#undef BUF2
+
+}
+
+void os_xor(void * dst, void WIDE* src1, void WIDE* src2, unsigned int length) {
+#define SRC1 ((unsigned char const WIDE *)src1)
+#define SRC2 ((unsigned char const WIDE *)src2)
+#define DST ((unsigned char *)dst)
+  unsigned short l = length;
+  // don't || to ensure all condition are evaluated
+  while(!(!length && !l)) {
+    length--;
+    l--;
+    DST[length] = SRC1[length] ^ SRC2[length];
+  }
+  // WHAT ??? glitch detected ?
+  if (l!=length) {
+    THROW(EXCEPTION);
+  }
+}
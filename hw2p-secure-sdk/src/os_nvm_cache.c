@@ -0,0 +1,225 @@
+/*******************************************************************************
+*   Ledger Blue - Secure firmware
+*   (c) 2016, 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#include "os.h"
+#include "cx.h"
+#include "os_nvm_cache.h"
+
+#ifdef HAVE_NVM_CACHE
+
+#define NVM_CACHE_MAGIC_0 'N'
+#define NVM_CACHE_MAGIC_1 'C'
+
+// magic, sequence, count, page indexes, crc16
+#define NVM_CACHE_HEADER_SIZE (4 + 2 * NVM_CACHE_PAGES + 2)
+#define NVM_CACHE_JOURNAL_SIZE ((1 + NVM_CACHE_PAGES) * NVM_PAGE_SIZE)
+
+nvm_cache_t G_nvm_cache;
+
+// journal slots, placed in NVRAM by the N_ prefix (see script.ld)
+static unsigned char N_nvm_cache_journals_real[NVM_CACHE_JOURNALS * NVM_CACHE_JOURNAL_SIZE]
+  __attribute__((aligned(NVM_PAGE_SIZE)));
+#define N_nvm_cache_journals ((unsigned char WIDE *)PIC(N_nvm_cache_journals_real))
+
+static unsigned char WIDE *nvm_cache_page_address(unsigned int page) {
+  return (unsigned char WIDE *)PIC(&_nvram) + page * NVM_PAGE_SIZE;
+}
+
+static unsigned char WIDE *nvm_cache_journal(unsigned int sequence) {
+  return N_nvm_cache_journals + (sequence & (NVM_CACHE_JOURNALS - 1)) * NVM_CACHE_JOURNAL_SIZE;
+}
+
+static nvm_cache_page_t *nvm_cache_lookup(unsigned int page) {
+  unsigned int i;
+  for (i = 0; i < G_nvm_cache.count; i++) {
+    if (G_nvm_cache.pages[i].page == page) {
+      return &G_nvm_cache.pages[i];
+    }
+  }
+  return NULL;
+}
+
+static unsigned int nvm_cache_journal_valid(unsigned char WIDE *journal) {
+  unsigned int count = journal[3];
+  unsigned int length = 4 + 2 * count;
+  unsigned int pages = ((unsigned int)&_envram - (unsigned int)&_nvram) / NVM_PAGE_SIZE;
+  unsigned short crc;
+  unsigned int i;
+
+  if (journal[0] != NVM_CACHE_MAGIC_0 || journal[1] != NVM_CACHE_MAGIC_1
+    || count == 0 || count > NVM_CACHE_PAGES) {
+    return 0;
+  }
+  for (i = 0; i < count; i++) {
+    // never program outside of the application NVRAM
+    if ((unsigned int)U2LE(journal, 4 + 2 * i) >= pages) {
+      return 0;
+    }
+  }
+  crc = cx_crc16(journal, length);
+  for (i = 0; i < count; i++) {
+    crc = cx_crc16_update(crc, journal + (1 + i) * NVM_PAGE_SIZE, NVM_PAGE_SIZE);
+  }
+  return U2LE(journal, length) == crc;
+}
+
+void nvm_cache_init(void) {
+  unsigned char WIDE *journal;
+  unsigned char WIDE *last = NULL;
+  unsigned char WIDE *address;
+  unsigned int i;
+
+  os_memset(&G_nvm_cache, 0, sizeof(G_nvm_cache));
+
+  for (i = 0; i < NVM_CACHE_JOURNALS; i++) {
+    journal = N_nvm_cache_journals + i * NVM_CACHE_JOURNAL_SIZE;
+    if (nvm_cache_journal_valid(journal)
+      && (last == NULL || (signed char)(journal[2] - G_nvm_cache.sequence) > 0)) {
+      last = journal;
+      G_nvm_cache.sequence = journal[2];
+    }
+  }
+  if (last == NULL) {
+    return;
+  }
+
+  // programs interrupted by a power loss, the pages of the previous
+  // batches are up to date
+  for (i = 0; i < last[3]; i++) {
+    address = nvm_cache_page_address(U2LE(last, 4 + 2 * i));
+    journal = last + (1 + i) * NVM_PAGE_SIZE;
+    if (os_memcmp(address, journal, NVM_PAGE_SIZE) != 0) {
+      nvm_write(address, journal, NVM_PAGE_SIZE);
+    }
+  }
+}
+
+// whether the page is part of the newest journal, which is replayed at boot
+static unsigned int nvm_cache_journaled(unsigned int page) {
+  unsigned char WIDE *journal = nvm_cache_journal(G_nvm_cache.sequence);
+  unsigned int i;
+
+  if (journal[0] != NVM_CACHE_MAGIC_0 || journal[1] != NVM_CACHE_MAGIC_1) {
+    return 0;
+  }
+  for (i = 0; i < journal[3] && i < NVM_CACHE_PAGES; i++) {
+    if ((unsigned int)U2LE(journal, 4 + 2 * i) == page) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void nvm_cache_write_checked(void WIDE *dst_adr, void WIDE *src_adr, unsigned int src_len) {
+  unsigned int offset = (unsigned int)dst_adr - (unsigned int)PIC(&_nvram);
+  unsigned int chunk;
+  nvm_cache_page_t *cached;
+
+  while (src_len) {
+    chunk = MIN(src_len, NVM_PAGE_SIZE - offset % NVM_PAGE_SIZE);
+    cached = nvm_cache_lookup(offset / NVM_PAGE_SIZE);
+    if (cached == NULL) {
+      if (G_nvm_cache.count == NVM_CACHE_PAGES) {
+        // splitting the batch would break its atomicity
+        THROW(EXCEPTION_OVERFLOW);
+      }
+      cached = &G_nvm_cache.pages[G_nvm_cache.count++];
+      cached->page = offset / NVM_PAGE_SIZE;
+      os_memmove(cached->data, nvm_cache_page_address(cached->page), NVM_PAGE_SIZE);
+    }
+    if (src_adr != NULL) {
+      os_memmove(cached->data + offset % NVM_PAGE_SIZE, src_adr, chunk);
+      src_adr = (unsigned char WIDE *)src_adr + chunk;
+    }
+    else {
+      os_memset(cached->data + offset % NVM_PAGE_SIZE, 0, chunk);
+    }
+    offset += chunk;
+    src_len -= chunk;
+  }
+}
+
+void nvm_cache_write(void WIDE *dst_adr, void WIDE *src_adr, unsigned int src_len) {
+  nvm_cache_write_checked(dst_adr, src_adr, src_len);
+  G_nvm_cache.journal = 1;
+}
+
+void WIDE *nvm_cache_map(void WIDE *address) {
+  unsigned int offset = (unsigned int)address - (unsigned int)PIC(&_nvram);
+  nvm_cache_page_t *cached = nvm_cache_lookup(offset / NVM_PAGE_SIZE);
+  if (cached == NULL) {
+    return address;
+  }
+  return cached->data + offset % NVM_PAGE_SIZE;
+}
+
+void nvm_cache_commit(void) {
+  unsigned char header[NVM_CACHE_HEADER_SIZE];
+  unsigned char WIDE *journal;
+  unsigned int length = 4 + 2 * G_nvm_cache.count;
+  unsigned short crc;
+  unsigned int i;
+
+  if (G_nvm_cache.count == 0) {
+    return;
+  }
+
+  if (G_nvm_cache.count == 1 && !G_nvm_cache.journal
+    && !nvm_cache_journaled(G_nvm_cache.pages[0].page)) {
+    // a torn program only loses the checked data of the page. Pages of the
+    // newest journal are journaled again, else they would be rolled back by
+    // its replay at boot
+    nvm_write(nvm_cache_page_address(G_nvm_cache.pages[0].page),
+              G_nvm_cache.pages[0].data, NVM_PAGE_SIZE);
+    G_nvm_cache.count = 0;
+    return;
+  }
+
+  journal = nvm_cache_journal(++G_nvm_cache.sequence);
+  header[0] = NVM_CACHE_MAGIC_0;
+  header[1] = NVM_CACHE_MAGIC_1;
+  header[2] = G_nvm_cache.sequence;
+  header[3] = G_nvm_cache.count;
+  for (i = 0; i < G_nvm_cache.count; i++) {
+    header[4 + 2 * i] = G_nvm_cache.pages[i].page;
+    header[5 + 2 * i] = G_nvm_cache.pages[i].page >> 8;
+  }
+  crc = cx_crc16(header, length);
+  for (i = 0; i < G_nvm_cache.count; i++) {
+    nvm_write(journal + (1 + i) * NVM_PAGE_SIZE, G_nvm_cache.pages[i].data, NVM_PAGE_SIZE);
+    crc = cx_crc16_update(crc, G_nvm_cache.pages[i].data, NVM_PAGE_SIZE);
+  }
+  header[length] = crc;
+  header[length + 1] = crc >> 8;
+
+  // commit marker, the batch is replayed at boot from now on
+  nvm_write(journal, header, length + 2);
+
+  for (i = 0; i < G_nvm_cache.count; i++) {
+    nvm_write(nvm_cache_page_address(G_nvm_cache.pages[i].page),
+              G_nvm_cache.pages[i].data, NVM_PAGE_SIZE);
+  }
+  G_nvm_cache.count = 0;
+  G_nvm_cache.journal = 0;
+}
+
+void nvm_cache_discard(void) {
+  G_nvm_cache.count = 0;
+  G_nvm_cache.journal = 0;
+}
+
+#endif // HAVE_NVM_CACHE
@@ -0,0 +1,249 @@
+/*******************************************************************************
+*   Ledger Blue - Secure firmware
+*   (c) 2016, 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+********************************************************************************/
+
+#include "os.h"
+#include "cx.h"
+#include "os_nvm_kv.h"
+#include "os_nvm_cache.h"
+
+#ifdef HAVE_NVM_KV
+
+#ifdef HAVE_NVM_CACHE
+// updates are committed with the reply to the command, records being read
+// from the cache until then. The index is built at boot, from the flash.
+#define NVM_KV_WRITE(dst, src, length) nvm_cache_write_checked(dst, src, length)
+#define NVM_KV_MAP(address) ((unsigned char WIDE *)nvm_cache_map(address))
+#else // HAVE_NVM_CACHE
+#define NVM_KV_WRITE(dst, src, length) nvm_write(dst, src, length)
+#define NVM_KV_MAP(address) (address)
+#endif // HAVE_NVM_CACHE
+
+#define NVM_KV_MAGIC_0 'K'
+#define NVM_KV_MAGIC_1 'V'
+
+#define NVM_KV_AREA_START(area) ((unsigned int)(area) * NVM_KV_AREA_SIZE)
+#define NVM_KV_AREA_END(area) (NVM_KV_AREA_START(area) + NVM_KV_AREA_SIZE)
+// first record page of the area
+#define NVM_KV_AREA_RECORD(area) (NVM_KV_AREA_START(area) + NVM_PAGE_SIZE)
+
+nvm_kv_t G_nvm_kv;
+
+// both areas, placed in NVRAM by the N_ prefix (see script.ld)
+static unsigned char N_nvm_kv_real[2 * NVM_KV_AREA_SIZE]
+  __attribute__((aligned(NVM_PAGE_SIZE)));
+#define N_nvm_kv ((unsigned char WIDE *)PIC(N_nvm_kv_real))
+
+static unsigned int nvm_kv_header_valid(unsigned int area) {
+  unsigned char WIDE *header = N_nvm_kv + NVM_KV_AREA_START(area);
+  return header[0] == NVM_KV_MAGIC_0 && header[1] == NVM_KV_MAGIC_1
+    && header[2] == (unsigned char)~header[3];
+}
+
+static void nvm_kv_write_header(unsigned int area, unsigned int generation) {
+  unsigned char header[NVM_KV_HEADER_SIZE];
+  header[0] = NVM_KV_MAGIC_0;
+  header[1] = NVM_KV_MAGIC_1;
+  header[2] = generation;
+  header[3] = ~generation;
+  NVM_KV_WRITE(N_nvm_kv + NVM_KV_AREA_START(area), header, sizeof(header));
+}
+
+static unsigned int nvm_kv_record_valid(unsigned int offset) {
+  unsigned char WIDE *record = N_nvm_kv + offset;
+  unsigned int length = record[1];
+  if (record[0] > NVM_KV_MAX_KEYS || length > NVM_KV_MAX_VALUE) {
+    return 0;
+  }
+  return U2LE(record, 2 + length) == cx_crc16(record, 2 + length);
+}
+
+// index the records of an area, the append offset is returned
+static unsigned int nvm_kv_scan(unsigned int area) {
+  unsigned char WIDE *region = N_nvm_kv;
+  unsigned int offset = NVM_KV_AREA_RECORD(area);
+  unsigned int end = NVM_KV_AREA_END(area);
+
+  while (offset < end && region[offset] != 0) {
+    // a torn page is the record being appended at the power loss, the key
+    // keeps its previous value
+    if (nvm_kv_record_valid(offset)) {
+      G_nvm_kv.index[region[offset] - 1] = region[offset + 1] ? offset : 0;
+    }
+    offset += NVM_PAGE_SIZE;
+  }
+  return offset;
+}
+
+// offset where a record is appended, 0 when the active area is full
+static unsigned int nvm_kv_append_offset(void) {
+  if (G_nvm_kv.head >= NVM_KV_AREA_END(G_nvm_kv.active)) {
+    return 0;
+  }
+  return G_nvm_kv.head;
+}
+
+static void nvm_kv_append(unsigned int offset, unsigned int key,
+                          const void WIDE *value, unsigned int length) {
+  unsigned char record[NVM_KV_RECORD_SIZE(NVM_KV_MAX_VALUE)];
+  unsigned short crc;
+
+  record[0] = key;
+  record[1] = length;
+  os_memmove(record + 2, value, length);
+  crc = cx_crc16(record, 2 + length);
+  record[2 + length] = crc;
+  record[3 + length] = crc >> 8;
+  NVM_KV_WRITE(N_nvm_kv + offset, record, NVM_KV_RECORD_SIZE(length));
+
+  G_nvm_kv.index[key - 1] = length ? offset : 0;
+  G_nvm_kv.head = offset + NVM_PAGE_SIZE;
+}
+
+static unsigned int nvm_kv_page_clean(unsigned int offset) {
+  unsigned char WIDE *page = NVM_KV_MAP(N_nvm_kv + offset);
+  unsigned int i;
+  for (i = 0; i < NVM_PAGE_SIZE; i++) {
+    if (page[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void nvm_kv_init(void) {
+  unsigned char WIDE *region = N_nvm_kv;
+  unsigned int valid0 = nvm_kv_header_valid(0);
+  unsigned int valid1 = nvm_kv_header_valid(1);
+
+  os_memset(&G_nvm_kv, 0, sizeof(G_nvm_kv));
+
+  if (valid0 && valid1) {
+    // interrupted compaction, the newer area is the active one, its records
+    // override the ones of the former area
+    G_nvm_kv.active =
+      (region[NVM_KV_AREA_START(1) + 2] == (unsigned char)(region[2] + 1)) ? 1 : 0;
+    G_nvm_kv.generation = region[NVM_KV_AREA_START(G_nvm_kv.active) + 2];
+    nvm_kv_scan(G_nvm_kv.active ^ 1);
+    G_nvm_kv.head = nvm_kv_scan(G_nvm_kv.active);
+    G_nvm_kv.state = NVM_KV_COMPACTING;
+    return;
+  }
+
+  if (!valid0 && !valid1) {
+    // first use, the region is zeroed at install
+    nvm_kv_write_header(0, 0);
+  }
+  else {
+    G_nvm_kv.active = valid0 ? 0 : 1;
+    G_nvm_kv.generation = region[NVM_KV_AREA_START(G_nvm_kv.active) + 2];
+  }
+  G_nvm_kv.head = nvm_kv_scan(G_nvm_kv.active);
+  // the spare area may not have been completely zeroed, clean pages are
+  // skipped without being programmed
+  G_nvm_kv.state = NVM_KV_ERASING;
+}
+
+unsigned int nvm_kv_get(unsigned int key, void *value, unsigned int size) {
+  unsigned char WIDE *record;
+  if (key == 0 || key > NVM_KV_MAX_KEYS || G_nvm_kv.index[key - 1] == 0) {
+    return 0;
+  }
+  record = NVM_KV_MAP(N_nvm_kv + G_nvm_kv.index[key - 1]);
+  os_memmove(value, record + 2, MIN(record[1], size));
+  return record[1];
+}
+
+void nvm_kv_set(unsigned int key, const void WIDE *value, unsigned int length) {
+  unsigned int offset;
+
+  if (key == 0 || key > NVM_KV_MAX_KEYS || length > NVM_KV_MAX_VALUE) {
+    THROW(EXCEPTION_OVERFLOW);
+  }
+  if (length == 0 && G_nvm_kv.index[key - 1] == 0) {
+    return;
+  }
+  if (G_nvm_kv.state == NVM_KV_COMPACTING) {
+    // keep the compaction ahead of the updates, see
+    // nvm_kv_area_too_small_for_the_keys
+    nvm_kv_step();
+  }
+  while ((offset = nvm_kv_append_offset()) == 0) {
+    if (!nvm_kv_step()) {
+      THROW(EXCEPTION_OVERFLOW);
+    }
+  }
+  nvm_kv_append(offset, key, value, length);
+}
+
+unsigned int nvm_kv_step(void) {
+  unsigned int spare = G_nvm_kv.active ^ 1;
+  unsigned char WIDE *record;
+  unsigned int offset;
+  unsigned int append;
+  unsigned int length;
+
+  switch (G_nvm_kv.state) {
+    case NVM_KV_COMPACTING:
+      while (G_nvm_kv.cursor < NVM_KV_MAX_KEYS) {
+        offset = G_nvm_kv.index[G_nvm_kv.cursor];
+        // keys not set or already rewritten in the active area are skipped
+        if (offset != 0 && offset >= NVM_KV_AREA_START(spare)
+          && offset < NVM_KV_AREA_END(spare)) {
+          record = NVM_KV_MAP(N_nvm_kv + offset);
+          length = record[1];
+          append = nvm_kv_append_offset();
+          if (append == 0) {
+            return 0;
+          }
+          nvm_kv_append(append, G_nvm_kv.cursor + 1, record + 2, length);
+          G_nvm_kv.cursor++;
+          return 1;
+        }
+        G_nvm_kv.cursor++;
+      }
+      // every live record copied, the former area is zeroed, header first
+      G_nvm_kv.state = NVM_KV_ERASING;
+      G_nvm_kv.cursor = 0;
+      return 1;
+
+    case NVM_KV_ERASING:
+      while (G_nvm_kv.cursor < NVM_KV_AREA_PAGES) {
+        offset = NVM_KV_AREA_START(spare) + G_nvm_kv.cursor++ * NVM_PAGE_SIZE;
+        if (!nvm_kv_page_clean(offset)) {
+          NVM_KV_WRITE(N_nvm_kv + offset, NULL, NVM_PAGE_SIZE);
+          return 1;
+        }
+      }
+      G_nvm_kv.state = NVM_KV_IDLE;
+      return 1;
+
+    default:
+      if (NVM_KV_AREA_END(G_nvm_kv.active) - G_nvm_kv.head > NVM_PAGE_SIZE) {
+        return 0;
+      }
+      // the clean area becomes the active one
+      G_nvm_kv.generation++;
+      nvm_kv_write_header(spare, G_nvm_kv.generation);
+      G_nvm_kv.active = spare;
+      G_nvm_kv.head = NVM_KV_AREA_RECORD(spare);
+      G_nvm_kv.state = NVM_KV_COMPACTING;
+      G_nvm_kv.cursor = 0;
+      return 1;
+  }
+}
+
+#endif // HAVE_NVM_KV
@@ -15,6 +15,8 @@
 *  limitations under the License.
 ********************************************************************************/
 
+#include "os.h"
+
 // gloomy fake definition to avoid problem with O3 and llvm with ignored return value in the caller
 unsigned int pic_internal(unsigned int link_address);
 
@@ -23,11 +25,30 @@ unsigned int pic_internal(unsigned int link_address);
 extern unsigned int _nvram;
 extern unsigned int _envram;
 unsigned int pic(unsigned int link_address) {
+  PIC_STATS_CALL();
+#ifdef HAVE_PIC_CACHE
+  return pic_cached(link_address);
+#else // HAVE_PIC_CACHE
 //  screen_printf(" %08X", link_address);
 	if (link_address >= ((unsigned int)&_nvram) && link_address < ((unsigned int)&_envram)) {
+		PIC_STATS_TRANSLATION();
 		link_address = pic_internal(link_address);
 //    screen_printf(" -> %08X\n", link_address);
   }
 	return link_address;
+#endif // HAVE_PIC_CACHE
 }
 
+#ifdef HAVE_PIC_CACHE
+unsigned int G_pic_delta;
+
+// to be called before any PIC(), from os_boot
+void pic_cache_init(void) {
+  G_pic_delta = (unsigned int)&_nvram - pic_internal((unsigned int)&_nvram);
+}
+#endif // HAVE_PIC_CACHE
+
+#ifdef HAVE_PIC_STATS
+pic_stats_t G_pic_stats;
+#endif // HAVE_PIC_STATS
+
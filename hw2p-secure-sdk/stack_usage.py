@@ -0,0 +1,194 @@
+"""
+*******************************************************************************
+*   Ledger SDK
+*   (c) 2017 Ledger
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*      http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+********************************************************************************
+
+Static stack analysis.
+Frame sizes are taken from the -fstack-usage output (*.su), or from the
+function prologue (push/sub sp) when the function has no .su entry (assembly,
+libgcc). The call graph is taken from the objdump disassembly (debug/app.asm).
+Indirect calls (PIC'd callbacks) are assumed to reach any function which is
+never called directly, svc are not accounted as the OS runs on its own stack.
+"""
+
+from __future__ import print_function
+
+import argparse
+import re
+import sys
+
+FUNCTION_RE = re.compile(r"^([0-9a-f]+) <([^>]+)>:$")
+CALL_RE = re.compile(r"\s(bl|blx|b|b\.n|b\.w)\s+([0-9a-f]+) <([^>+]+)>")
+INDIRECT_RE = re.compile(r"\s(blx|bx)\s+(r[0-9]+|ip|sl|fp)\b")
+PUSH_RE = re.compile(r"\spush\s+\{([^}]*)\}")
+SUBSP_RE = re.compile(r"\ssub\s+sp,\s*(?:sp,\s*)?#(\d+)")
+STACK_SIZE_RE = re.compile(r"^\s*STACK_SIZE\s*=\s*(\d+)\s*;")
+
+
+def parse_su(filenames):
+	frames = {}
+	for filename in filenames:
+		for line in open(filename):
+			fields = line.rstrip("\n").split("\t")
+			if len(fields) < 2:
+				continue
+			name = fields[0].split(":")[-1]
+			size = int(fields[1])
+			frames[name] = max(size, frames.get(name, 0))
+	return frames
+
+
+def parse_asm(filename):
+	calls = {}
+	prologue = {}
+	indirect = set()
+	current = None
+	for line in open(filename):
+		line = line.rstrip("\n")
+		m = FUNCTION_RE.match(line)
+		if m:
+			current = m.group(2)
+			calls.setdefault(current, set())
+			prologue[current] = 0
+			continue
+		if current is None:
+			continue
+		m = CALL_RE.search(line)
+		if m:
+			callee = m.group(3)
+			# a branch to the function start is a loop, not a recursion
+			if callee != current or m.group(1) == "bl":
+				calls[current].add(callee)
+			continue
+		m = INDIRECT_RE.search(line)
+		if m and m.group(1) == "blx":
+			indirect.add(current)
+			continue
+		m = PUSH_RE.search(line)
+		if m:
+			prologue[current] += 4 * len(m.group(1).split(","))
+			continue
+		m = SUBSP_RE.search(line)
+		if m:
+			prologue[current] += int(m.group(1))
+	return calls, prologue, indirect
+
+
+def parse_stack_size(filename):
+	for line in open(filename):
+		m = STACK_SIZE_RE.match(line)
+		if m:
+			return int(m.group(1))
+	return None
+
+
+class Analyzer:
+	def __init__(self, calls, frames, indirect, roots):
+		self.calls = calls
+		self.frames = frames
+		self.indirect = indirect
+		self.worst = {}
+		self.recursive = set()
+		called = set()
+		for callees in calls.values():
+			called |= callees
+		self.indirect_targets = sorted(f for f in calls if f not in called and f not in roots)
+
+	def frame(self, name):
+		return self.frames.get(name, 0)
+
+	def depth(self, name, stack=()):
+		return self._depth(name, stack)[:2]
+
+	def _depth(self, name, stack):
+		if name in self.worst:
+			return self.worst[name]
+		if name in stack:
+			self.recursive.add(name)
+			return (0, [], True)
+		stack = stack + (name,)
+		best = (0, [])
+		partial = False
+		callees = list(self.calls.get(name, ()))
+		if name in self.indirect:
+			callees += [f for f in self.indirect_targets if f != name]
+		for callee in callees:
+			d = self._depth(callee, stack)
+			partial = partial or d[2]
+			if d[0] > best[0]:
+				best = d
+		result = (self.frame(name) + best[0], [name] + best[1], partial)
+		# results cut by a recursion depend on the path, don't keep them
+		if not partial:
+			self.worst[name] = result
+		return result
+
+
+def main():
+	parser = argparse.ArgumentParser(description="static stack usage analysis")
+	parser.add_argument("--asm", required=True, help="objdump -d output")
+	parser.add_argument("--script", help="linker script to read STACK_SIZE from")
+	parser.add_argument("--limit", type=int, help="stack size, overrides --script")
+	parser.add_argument("--root", action="append", help="entry points, default main")
+	parser.add_argument("--top", type=int, default=15)
+	parser.add_argument("su", nargs="*", help="-fstack-usage outputs")
+	args = parser.parse_args()
+
+	calls, prologue, indirect = parse_asm(args.asm)
+	frames = dict(prologue)
+	su = parse_su(args.su)
+	frames.update(su)
+	if not su:
+		print("warning: no .su file, frames estimated from the prologues")
+
+	roots = args.root or ["main"]
+	analyzer = Analyzer(calls, frames, indirect, roots)
+
+	print("%-40s %8s %8s" % ("function", "frame", "worst"))
+	ranked = sorted(calls, key=lambda f: -analyzer.depth(f)[0])
+	for name in ranked[:args.top]:
+		print("%-40s %8d %8d" % (name, analyzer.frame(name), analyzer.depth(name)[0]))
+
+	limit = args.limit
+	if limit is None and args.script:
+		limit = parse_stack_size(args.script)
+
+	failed = False
+	for root in roots:
+		if root not in calls:
+			print("error: root %s not found" % root)
+			failed = True
+			continue
+		total, path = analyzer.depth(root)
+		print("")
+		print("worst path from %s: %d bytes" % (root, total))
+		for name in path:
+			mark = " (indirect call)" if name in indirect else ""
+			print("  %6d  %s%s" % (analyzer.frame(name), name, mark))
+		if limit is not None:
+			print("stack size: %d bytes, headroom: %d bytes" % (limit, limit - total))
+			if total > limit:
+				failed = True
+
+	if analyzer.recursive:
+		print("")
+		print("warning: recursion not bounded: %s" % ", ".join(sorted(analyzer.recursive)))
+
+	return 1 if failed else 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())